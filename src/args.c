@@ -1,7 +1,10 @@
+// Flags taking a single value accept it either as the next argument or after
+// '=', as in `--jobs=4`; optional values only in the latter form.
 typedef enum Args_Kind {
     args_kind_bool = 0,
     args_kind_single_pos,
     args_kind_multi_pos,
+    args_kind_optional_pos,
 } Args_Kind;
 
 typedef struct Args_Flag {
@@ -43,7 +46,8 @@ static error args_parse(int argc, char **argv, Args_Desc *desc) {
                         str8_fmt(arg)
                     );
                 } break;
-                case args_kind_single_pos: {
+                case args_kind_single_pos:
+                case args_kind_optional_pos: {
                     if (desc->single_pos.len != 0 || 
                         desc->single_pos.ptr != 0
                     ) {
@@ -73,13 +77,19 @@ static error args_parse(int argc, char **argv, Args_Desc *desc) {
             continue;
         }
 
+        usize name_end = 0;
+        while (name_end < arg.len && arg.ptr[name_end] != '=') name_end += 1;
+        bool has_value = name_end < arg.len;
+        Str8 value = has_value ? str8_range(arg, name_end + 1, arg.len) :
+            (Str8){ 0 };
+
         Args_Flag *flag = 0;
         for (usize j = 0; j < flags->len; j += 1) {
             bool single_dash = (arg.ptr[0] == '-') && 
-                str8_eql(str8_range(arg, 1, arg.len), flags->ptr[j]->name);
-            bool double_dash = arg.len > 2 && 
+                str8_eql(str8_range(arg, 1, name_end), flags->ptr[j]->name);
+            bool double_dash = name_end > 2 && 
                 str8_eql(str8_range(arg, 0, 2), str8("--")) &&
-                str8_eql(str8_range(arg, 2, arg.len), flags->ptr[j]->name);
+                str8_eql(str8_range(arg, 2, name_end), flags->ptr[j]->name);
             if (!single_dash && !double_dash) continue;
 
             flag = flags->ptr[j];
@@ -87,10 +97,25 @@ static error args_parse(int argc, char **argv, Args_Desc *desc) {
             break;
         }
         if (flag == 0) return errf("invalid flag '%.*s'", str8_fmt(arg));
+        if (has_value && (
+            flag->kind == args_kind_bool || flag->kind == args_kind_multi_pos
+        )) {
+            return errf("unexpected value in '%.*s'", str8_fmt(arg));
+        }
 
         switch (flag->kind) {
             case args_kind_bool: break;
+            case args_kind_optional_pos: {
+                flag->single_pos = value;
+            } break;
             case args_kind_single_pos: {
+                if (has_value) {
+                    if (value.len == 0) return errf(
+                        "expected a value in '%.*s'", str8_fmt(arg)
+                    );
+                    flag->single_pos = value;
+                    break;
+                }
                 if (i + 1 == argc || argv[i + 1][0] == '-') return errf(
                     "expected positional argument after '%.*s'", 
                     str8_fmt(arg)
@@ -2,6 +2,9 @@
 #define BASE
 
 #define _CRT_SECURE_NO_WARNINGS
+#define _POSIX_C_SOURCE 200809L
+#define _DARWIN_C_SOURCE
+#define _DEFAULT_SOURCE
 
 #include <stdarg.h>
 #include <stdbool.h>
@@ -30,9 +33,20 @@ typedef      intptr_t  iptr;
 
 typedef int error;
 
+#define thread_local_var __thread
+
+// For helpers that not every program built from these files calls, such as
+// the library, src/imgclr.c on its own.
+#define maybe_unused __attribute__((unused))
+
+// Error messages go to stderr unless a thread redirects them, e.g. so that a
+// server can send them back to the client whose request failed.
+static thread_local_var FILE *err_file;
+#define err_out (err_file != NULL ? err_file : stderr)
+
 static error fatal(char *file, usize line, const char *func) {
     #ifdef DEBUG
-        fprintf(stderr, "%s:%zu:%s() fatal error\n", file, line, func);
+        fprintf(err_out, "%s:%zu:%s() fatal error\n", file, line, func);
     #else
         (void)file;
         (void)line;
@@ -46,10 +60,10 @@ static error fatal(char *file, usize line, const char *func) {
 
 #define err(s) _err(__func__, s)
 static error _err(const char *func, char *s) {
-    fprintf(stderr, "error: %s\n", s);
+    fprintf(err_out, "error: %s\n", s);
 
     #ifdef DEBUG
-        fprintf(stderr, "note: in function '%s'\n", func);
+        fprintf(err_out, "note: in function '%s'\n", func);
     #else
         (void)func;
     #endif // DEBUG
@@ -59,15 +73,16 @@ static error _err(const char *func, char *s) {
 
 #define errf(fmt, ...) _errf(__func__, fmt, __VA_ARGS__)
 static error _errf(const char *func, char *fmt, ...) {
-    fprintf(stderr, "error: ");
+    FILE *out = err_out;
+    fprintf(out, "error: ");
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    vfprintf(out, fmt, args);
     va_end(args);
-    fprintf(stderr, "\n");
+    fprintf(out, "\n");
 
     #ifdef DEBUG
-        fprintf(stderr, "note: in function '%s'\n", func);
+        fprintf(out, "note: in function '%s'\n", func);
     #else
         (void)func;
     #endif // DEBUG
@@ -108,6 +123,7 @@ static error _arena_alloc(Arena *arena, usize size, void **out) {
 
 static void arena_deinit(Arena *arena) {
     free(arena->mem);
+    arena->mem = NULL;
     arena->offset = 0;
     arena->cap = 0;
 }
@@ -140,7 +156,7 @@ static Str8 str8_from_cstr(char *s) {
     return (Str8){ .ptr = (u8 *)s, .len = len };
 }
 
-static char *cstr_from_str8(Arena *arena, Str8 s) {
+static maybe_unused char *cstr_from_str8(Arena *arena, Str8 s) {
     char *cstr; arena_alloc(arena, s.len + 1, &cstr);
     for (usize i = 0; i < s.len; i += 1) cstr[i] = s.ptr[i];
     cstr[s.len] = '\0';
@@ -148,7 +164,12 @@ static char *cstr_from_str8(Arena *arena, Str8 s) {
 }
 
 // Only bases <= 10
-static error str8_from_int_base(Arena *arena, usize _num, u8 base, Str8 *out) {
+static maybe_unused error str8_from_int_base(
+    Arena *arena,
+    usize _num,
+    u8 base,
+    Str8 *out
+) {
     out->len = 0;
     usize num = _num;
 
@@ -192,40 +213,57 @@ static usize decimal_from_hex_str8(Str8 s) {
     return result;
 }
 
-static error file_open(Str8 path, char *mode, FILE **file_out) {
+static error usize_from_str8(Str8 s, usize *out) {
+    if (s.len == 0) return err("expected a number");
+    usize result = 0;
+    for (usize i = 0; i < s.len; i += 1) {
+        if (s.ptr[i] < '0' || s.ptr[i] > '9') {
+            return errf("invalid number '%.*s'", str8_fmt(s));
+        }
+        usize digit = (usize)(s.ptr[i] - '0');
+        if (result > (SIZE_MAX - digit) / 10) {
+            return errf("number '%.*s' is too large", str8_fmt(s));
+        }
+        result = result * 10 + digit;
+    }
+    *out = result;
+    return 0;
+}
+
+static maybe_unused error file_open(Str8 path, char *mode, FILE **file_out) {
     FILE *file = NULL;
     if (path.len == 0) return err("empty path");
     if (mode == NULL) return err("invalid mode");
 
     if ((file = fopen((char *)path.ptr, mode)) == NULL) {
-        return errf("failed to open file '%.*s'", path);
+        return errf("failed to open file '%.*s'", str8_fmt(path));
     }
 
     *file_out = file;
     return 0;
 }
 
-static error file_read(Arena *arena, Str8 path, char *mode, Str8 *out) {
-    FILE *file; try (file_open(path, mode, &file));
-    
-    fseek(file, 0L, SEEK_END);
-    usize filesize = ftell(file);
+static error file_len(FILE *file, usize *out) {
+    if (fseek(file, 0L, SEEK_END) != 0) return err("unable to seek file");
+    long len = ftell(file);
+    if (len < 0) return err("unable to get file size");
+    fseek(file, 0L, SEEK_SET);
+    *out = (usize)len;
+    return 0;
+}
+
+static maybe_unused error file_read_from(Arena *arena, FILE *file, Str8 *out) {
+    usize filesize = 0; try (file_len(file, &filesize));
     try (arena_alloc(arena, filesize + 1, &out->ptr));
 
-    fseek(file, 0L, SEEK_SET);
     out->len = fread(out->ptr, sizeof(u8), filesize, file);
     out->ptr[out->len] = '\0';
 
-    if (ferror(file)) {
-        fclose(file);
-        return err("error reading file");
-    }
-
-    fclose(file);
+    if (ferror(file)) return err("error reading file");
     return 0;
 }
 
-static void file_write(FILE *file, Str8 memory) {
+static maybe_unused void file_write(FILE *file, Str8 memory) {
     fwrite(memory.ptr, memory.len, 1, file);
 }
 
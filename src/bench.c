@@ -0,0 +1,482 @@
+// Benchmark for the quantiser, built separately from the tool:
+//
+//     cc src/bench.c -O3 -lm -lpthread -o ./imgclr-bench
+//
+// Quantises synthetic images, generated from a fixed seed so that every run
+// sees the same pixels, with every dithering algorithm, a range of palette
+// sizes, and with and without --invert. Each case reports the best of several
+// runs, and a hash of its output so that comparisons between commits can
+// tell a faster quantiser from one that produces different images.
+//
+// With --search, it instead times each nearest-colour search on its own, per
+// palette size and kind of pixels, as `imgclr --calibrate` does.
+
+#include "base.c"
+
+#define version_lit "0.3"
+
+const Str8 help_text = str8(
+"imgclr-bench - quantiser benchmark (version " version_lit ")\n"
+"\n"
+"Usage: imgclr-bench [options]\n"
+"\n"
+"Options:\n"
+"      --sizes <width>x<height>...\n"
+"        Image sizes to benchmark (default: 256x256 1024x1024)\n"
+"      --repeat <n>\n"
+"        Runs per case, of which the fastest counts (default: 3)\n"
+"      --json <file>\n"
+"        Also write the results to <file> as JSON, one case per line\n"
+"      --baseline <file>\n"
+"        Compare with the JSON written by an earlier run, such as on\n"
+"        another commit, and flag cases whose output changed\n"
+"      --search\n"
+"        Time each nearest-colour search per palette size on uniform,\n"
+"        photo-like and flat pixels, instead of the quantiser as a whole\n"
+"  -h, --help\n"
+"        Print this help and exit\n"
+);
+
+#include "imgclr.c"
+#include "args.c"
+#include "hash.c"
+#include "clock.c"
+#include "measure.c"
+
+typedef enum {
+    BENCH_GRADIENT,
+    BENCH_NOISE,
+    BENCH_PHOTO,
+    BENCH_IMAGES_LEN,
+} Bench_Image;
+
+static const char *bench_image_names[BENCH_IMAGES_LEN] = {
+    "gradient", "noise", "photo",
+};
+
+typedef struct {
+    const char *name;
+    const Dither_Algorithm *algorithm;
+} Bench_Algorithm;
+
+static const Bench_Algorithm bench_algorithms[] = {
+    { "none", &none },
+    { "floyd-steinberg", &floyd_steinberg },
+    { "atkinson", &atkinson },
+    { "jjn", &jjn },
+    { "burkes", &burkes },
+    { "sierra-lite", &sierra_lite },
+};
+
+static const usize bench_palette_lens[] = { 2, 4, 16, 64, 256 };
+
+// xorshift64*, for images and palettes that are the same on every platform.
+static u64 bench_random(u64 *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static u8 bench_channel(f64 x) {
+    if (x < 0) return 0;
+    if (x > 255) return 255;
+    return (u8)x;
+}
+
+static void bench_image_generate(
+    Bench_Image image,
+    usize width,
+    usize height,
+    u8 *out
+) {
+    u64 state = 0x9e3779b97f4a7c15ull + image;
+    for (usize y = 0; y < height; y += 1) {
+        for (usize x = 0; x < width; x += 1) {
+            f64 u = (f64)x / (f64)width, v = (f64)y / (f64)height;
+            u8 *pixel = out + 3 * (y * width + x);
+            switch (image) {
+                case BENCH_GRADIENT: {
+                    pixel[0] = bench_channel(255 * u);
+                    pixel[1] = bench_channel(255 * v);
+                    pixel[2] = bench_channel(255 * (1 - u) * v);
+                } break;
+                case BENCH_NOISE: {
+                    u64 r = bench_random(&state);
+                    pixel[0] = (u8)r;
+                    pixel[1] = (u8)(r >> 8);
+                    pixel[2] = (u8)(r >> 16);
+                } break;
+                case BENCH_PHOTO: {
+                    // Smooth regions of related colours with some grain,
+                    // which is closer to a photograph than either of the
+                    // above.
+                    f64 a = sin(7 * u + 3 * v) + sin(11 * v - 2 * u);
+                    f64 b = cos(5 * u * v + 4 * u) + sin(9 * u - 6 * v);
+                    f64 grain = (f64)(bench_random(&state) & 15) - 7.5;
+                    pixel[0] = bench_channel(128 + 50 * a + 20 * b + grain);
+                    pixel[1] = bench_channel(110 + 40 * a - 30 * b + grain);
+                    pixel[2] = bench_channel(90 + 25 * b - 15 * a + grain);
+                } break;
+                case BENCH_IMAGES_LEN: break;
+            }
+        }
+    }
+}
+
+// Black and white, then colours from a fixed seed.
+static void bench_palette_generate(usize len, Rgb *out) {
+    u64 state = 0x2545f4914f6cdd1dull + len;
+    out[0] = (Rgb){ 0 };
+    out[1] = (Rgb){ .r = 255, .g = 255, .b = 255 };
+    for (usize i = 2; i < len; i += 1) {
+        u64 r = bench_random(&state);
+        out[i] = (Rgb){ .r = (u8)r, .g = (u8)(r >> 8), .b = (u8)(r >> 16) };
+    }
+}
+
+typedef struct {
+    usize width;
+    usize height;
+} Bench_Size;
+
+typedef Slice(Bench_Size) Bench_Sizes;
+
+static error bench_sizes_from_flag(
+    Arena *arena,
+    char **argv,
+    Args_Flag *flag,
+    Bench_Sizes *out
+) {
+    static Bench_Size default_sizes[] = { { 256, 256 }, { 1024, 1024 } };
+    if (!flag->is_present) {
+        *out = (Bench_Sizes)slice(default_sizes);
+        return 0;
+    }
+    out->len = (usize)(flag->multi_pos.end_i - flag->multi_pos.beg_i);
+    try (arena_alloc(arena, out->len * sizeof(Bench_Size), &out->ptr));
+    for (usize i = 0; i < out->len; i += 1) {
+        Str8 size = str8_from_cstr(argv[flag->multi_pos.beg_i + (int)i]);
+        usize x_i = 0;
+        while (x_i < size.len && size.ptr[x_i] != 'x') x_i += 1;
+        Bench_Size *s = &out->ptr[i];
+        if (x_i == size.len ||
+            usize_from_str8(str8_range(size, 0, x_i), &s->width) != 0 ||
+            usize_from_str8(str8_range(size, x_i + 1, size.len), &s->height)
+                != 0 ||
+            s->width == 0 || s->height == 0
+        ) {
+            return errf(
+                "expected size as <width>x<height>, got '%.*s'",
+                str8_fmt(size)
+            );
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    Bench_Image image;
+    Bench_Size size;
+    const Bench_Algorithm *algorithm;
+    usize palette_len;
+    bool invert;
+    u64 ns;
+    u64 hash;
+} Bench_Case;
+
+// Times the inversion and quantisation of a fresh copy of `source`, as the
+// tool would process it, keeping the fastest of `repeat` runs.
+static void bench_case_run(
+    Bench_Case *c,
+    const u8 *source,
+    u8 *scratch,
+    usize repeat
+) {
+    Rgb colours[256];
+    bench_palette_generate(c->palette_len, colours);
+    Palette palette = { .ptr = colours, .len = c->palette_len };
+    usize data_len = c->size.width * c->size.height * 3;
+
+    c->ns = 0;
+    for (usize run = 0; run < repeat; run += 1) {
+        memcpy(scratch, source, data_len);
+        u64 beg_ns = clock_now();
+        if (c->invert) image_invert(scratch, data_len);
+        image_quantise(
+            scratch,
+            c->size.width,
+            c->size.height,
+            palette,
+            *c->algorithm->algorithm
+        );
+        u64 ns = clock_now() - beg_ns;
+        if (run == 0 || ns < c->ns) c->ns = ns;
+    }
+    c->hash = hash64(scratch, data_len, 0);
+}
+
+static f64 bench_mp_per_s(const Bench_Case *c) {
+    f64 pixels = (f64)c->size.width * (f64)c->size.height;
+    return c->ns == 0 ? 0 : pixels / 1e6 / ((f64)c->ns / 1e9);
+}
+
+static void bench_case_print_json(FILE *file, const Bench_Case *c) {
+    fprintf(
+        file,
+        "{\"image\":\"%s\",\"width\":%zu,\"height\":%zu,"
+            "\"algorithm\":\"%s\",\"colours\":%zu,\"invert\":%s,"
+            "\"ms\":%.3f,\"mp_per_s\":%.3f,\"hash\":\"%016llx\"}",
+        bench_image_names[c->image],
+        c->size.width,
+        c->size.height,
+        c->algorithm->name,
+        c->palette_len,
+        c->invert ? "true" : "false",
+        (f64)c->ns / 1e6,
+        bench_mp_per_s(c),
+        (unsigned long long)c->hash
+    );
+}
+
+// A case from the JSON of an earlier run, given with --baseline.
+typedef struct {
+    char image[16];
+    usize width;
+    usize height;
+    char algorithm[32];
+    usize palette_len;
+    bool invert;
+    f64 mp_per_s;
+    u64 hash;
+} Bench_Result;
+
+typedef Slice(Bench_Result) Bench_Results;
+
+// Reads back the JSON written by bench_case_print_json, one case per line.
+static error bench_results_read(Arena *arena, Str8 path, Bench_Results *out) {
+    FILE *file = NULL; try (file_open(path, "rb", &file));
+    Str8 contents;
+    error e = file_read_from(arena, file, &contents);
+    fclose(file);
+    if (e != 0) return e;
+    usize cap = 0;
+    for (usize i = 0; i < contents.len; i += 1) {
+        cap += contents.ptr[i] == '\n';
+    }
+    try (arena_alloc(arena, cap * sizeof(Bench_Result), &out->ptr));
+    out->len = 0;
+
+    char *line = (char *)contents.ptr;
+    while (line != NULL && *line != '\0' && out->len < cap) {
+        Bench_Result *r = &out->ptr[out->len];
+        char invert[8];
+        f64 ms;
+        unsigned long long hash;
+        int matched = sscanf(
+            line,
+            "{\"image\":\"%15[^\"]\",\"width\":%zu,\"height\":%zu,"
+                "\"algorithm\":\"%31[^\"]\",\"colours\":%zu,"
+                "\"invert\":%7[a-z],\"ms\":%lf,\"mp_per_s\":%lf,"
+                "\"hash\":\"%llx\"}",
+            r->image, &r->width, &r->height, r->algorithm, &r->palette_len,
+            invert, &ms, &r->mp_per_s, &hash
+        );
+        if (matched == 9) {
+            r->invert = strcmp(invert, "true") == 0;
+            r->hash = hash;
+            out->len += 1;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) line += 1;
+    }
+    if (out->len == 0) {
+        return errf("no benchmark results in '%.*s'", str8_fmt(path));
+    }
+    return 0;
+}
+
+static const Bench_Result *bench_results_find(
+    Bench_Results results,
+    const Bench_Case *c
+) {
+    for (usize i = 0; i < results.len; i += 1) {
+        const Bench_Result *r = &results.ptr[i];
+        if (strcmp(r->image, bench_image_names[c->image]) == 0 &&
+            r->width == c->size.width && r->height == c->size.height &&
+            strcmp(r->algorithm, c->algorithm->name) == 0 &&
+            r->palette_len == c->palette_len && r->invert == c->invert
+        ) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static void bench_case_print(const Bench_Case *c, Bench_Results baseline) {
+    char size[32];
+    snprintf(size, sizeof(size), "%zux%zu", c->size.width, c->size.height);
+    printf(
+        "%-9s %-11s %-16s %7zu %6s %10.3f %10.2f",
+        bench_image_names[c->image], size, c->algorithm->name,
+        c->palette_len, c->invert ? "yes" : "no",
+        (f64)c->ns / 1e6, bench_mp_per_s(c)
+    );
+    if (baseline.len != 0) {
+        const Bench_Result *r = bench_results_find(baseline, c);
+        if (r == NULL || r->mp_per_s == 0) {
+            printf(" %10s", "-");
+        } else {
+            printf(" %+9.1f%%", 100 * (bench_mp_per_s(c) / r->mp_per_s - 1));
+            // The output itself changed, so this is not a like-for-like
+            // comparison.
+            if (r->hash != c->hash) printf(" output differs");
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static error bench_run(
+    Bench_Sizes sizes,
+    usize repeat,
+    Bench_Results baseline,
+    FILE *json
+) {
+    if (json != NULL) {
+        fprintf(json, "{\"version\":\"%s\",\"cases\":[\n", version_lit);
+    }
+    printf(
+        "%-9s %-11s %-16s %7s %6s %10s %10s",
+        "image", "size", "algorithm", "colours", "invert", "ms", "MP/s"
+    );
+    if (baseline.len != 0) printf(" %10s", "change");
+    printf("\n");
+
+    bool first = true;
+    for (usize size_i = 0; size_i < sizes.len; size_i += 1) {
+        Bench_Size size = sizes.ptr[size_i];
+        usize data_len = size.width * size.height * 3;
+        u8 *source = malloc(data_len);
+        u8 *scratch = malloc(data_len);
+        if (source == NULL || scratch == NULL) {
+            free(source);
+            free(scratch);
+            return err("allocation failure");
+        }
+
+        for (usize image = 0; image < BENCH_IMAGES_LEN; image += 1) {
+            bench_image_generate(image, size.width, size.height, source);
+            for (usize a = 0; a < count_of(bench_algorithms); a += 1) {
+                for (usize p = 0; p < count_of(bench_palette_lens); p += 1) {
+                    for (usize invert = 0; invert < 2; invert += 1) {
+                        Bench_Case c = {
+                            .image = image,
+                            .size = size,
+                            .algorithm = &bench_algorithms[a],
+                            .palette_len = bench_palette_lens[p],
+                            .invert = invert,
+                        };
+                        bench_case_run(&c, source, scratch, repeat);
+                        bench_case_print(&c, baseline);
+                        if (json != NULL) {
+                            fprintf(json, first ? "" : ",\n");
+                            bench_case_print_json(json, &c);
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+        free(source);
+        free(scratch);
+    }
+
+    if (json != NULL) fprintf(json, "\n]}\n");
+    return 0;
+}
+
+static error bench_search_run(usize repeat) {
+    for (usize i = 0; i < MEASURE_PIXELS_LEN; i += 1) {
+        Measure_Row rows[search_table_len];
+        try (measure_searches(i, repeat, rows));
+        if (i != 0) printf("\n");
+        printf("%s pixels:\n", measure_pixels_names[i]);
+        measure_print(stdout, rows);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static error main_wrapper(int argc, char **argv) {
+    Arena arena; try (arena_init(&arena, 16 * 1024 * 1024));
+
+    Args_Flag sizes_flag = {
+        .name = str8("sizes"),
+        .kind = args_kind_multi_pos,
+    };
+    Args_Flag repeat_flag = {
+        .name = str8("repeat"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag json_flag = {
+        .name = str8("json"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag baseline_flag = {
+        .name = str8("baseline"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag search_flag = { .name = str8("search") };
+    Args_Flag help_flag_short = { .name = str8("h") };
+    Args_Flag help_flag_long = { .name = str8("help") };
+    Args_Flag *flags[] = {
+        &sizes_flag,
+        &repeat_flag,
+        &json_flag,
+        &baseline_flag,
+        &search_flag,
+        &help_flag_short, &help_flag_long,
+    };
+    Args_Desc args_desc = {
+        .exe_kind = args_kind_bool,
+        .flags = slice(flags),
+    };
+    try (args_parse(argc, argv, &args_desc));
+
+    if (help_flag_short.is_present || help_flag_long.is_present) {
+        printf("%.*s", str8_fmt(help_text));
+        return 0;
+    }
+
+    Bench_Sizes sizes = { 0 };
+    try (bench_sizes_from_flag(&arena, argv, &sizes_flag, &sizes));
+    usize repeat = 3;
+    if (repeat_flag.is_present) {
+        try (usize_from_str8(repeat_flag.single_pos, &repeat));
+        if (repeat == 0) return err("expected at least one (1) run");
+    }
+
+    if (search_flag.is_present) {
+        arena_deinit(&arena);
+        return bench_search_run(repeat);
+    }
+
+    Bench_Results baseline = { 0 };
+    if (baseline_flag.is_present) {
+        try (bench_results_read(&arena, baseline_flag.single_pos, &baseline));
+    }
+
+    FILE *json = NULL;
+    if (json_flag.is_present) try (file_open(json_flag.single_pos, "w", &json));
+    error e = bench_run(sizes, repeat, baseline, json);
+    if (json != NULL && fclose(json) != 0) {
+        e = errf("error writing '%.*s'", str8_fmt(json_flag.single_pos));
+    }
+    arena_deinit(&arena);
+    return e;
+}
+
+int main(int argc, char **argv) {
+    return main_wrapper(argc, argv);
+}
@@ -0,0 +1,245 @@
+// 1-bit encoders for images quantised to two colours, as for e-ink displays.
+// PNG and BMP keep both colours in a two-entry palette; PBM has no palette and
+// shows the darker colour as black. Rows are packed with the leftmost pixel in
+// the high bit, which all three formats share.
+
+#ifdef DEBUG
+    // Defined in stbi.c, but not declared by stb_image_write.h.
+    unsigned char *stbi_zlib_compress(
+        unsigned char *data, int data_len, int *out_len, int quality
+    );
+#endif // DEBUG
+
+typedef struct Bilevel_Writer {
+    stbi_write_func *func;
+    void *ctx;
+    // The two colours. A palette of a single colour is paired with black or
+    // white, whichever it is furthest from.
+    Rgb colours[2];
+} Bilevel_Writer;
+
+static Bilevel_Writer bilevel_writer(
+    stbi_write_func *func,
+    void *ctx,
+    Palette palette
+) {
+    Bilevel_Writer w = { .func = func, .ctx = ctx };
+    w.colours[0] = palette.ptr[0];
+    w.colours[1] = palette.ptr[palette.len - 1];
+    if (palette.len == 1) {
+        Rgb c = palette.ptr[0];
+        bool light = c.r + c.g + c.b >= 383;
+        w.colours[1] = light ? (Rgb){ 0, 0, 0 } : (Rgb){ 255, 255, 255 };
+    }
+    return w;
+}
+
+static void bilevel_put(Bilevel_Writer *w, const void *data, usize len) {
+    w->func(w->ctx, (void *)data, (int)len);
+}
+
+static void bilevel_put_u32_be(u8 *out, u32 value) {
+    out[0] = (u8)(value >> 24), out[1] = (u8)(value >> 16);
+    out[2] = (u8)(value >> 8), out[3] = (u8)value;
+}
+
+static void bilevel_put_u32_le(u8 *out, u32 value) {
+    out[0] = (u8)value, out[1] = (u8)(value >> 8);
+    out[2] = (u8)(value >> 16), out[3] = (u8)(value >> 24);
+}
+
+// Sets a bit for each pixel of `one` in a row, where the only other colour a
+// pixel may have is the other of the two. `channels` is 3 for rgb or 1 for
+// grey. Clears the rest of the `stride` bytes.
+static void bilevel_pack_row(
+    const u8 *row,
+    usize width,
+    int channels,
+    Rgb one,
+    u8 *out,
+    usize stride
+) {
+    memset(out, 0, stride);
+    for (usize x = 0; x < width; x += 1) {
+        const u8 *pixel = row + x * channels;
+        bool bit = channels == 1 ? pixel[0] == one.r :
+            pixel[0] == one.r && pixel[1] == one.g && pixel[2] == one.b;
+        out[x >> 3] |= (u8)(bit << (7 - (x & 7)));
+    }
+}
+
+static u32 bilevel_crc32(u32 crc, const u8 *data, usize len) {
+    static u32 table[256];
+    if (table[1] == 0) {
+        for (u32 i = 0; i < 256; i += 1) {
+            u32 c = i;
+            for (int k = 0; k < 8; k += 1) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (usize i = 0; i < len; i += 1) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void bilevel_png_chunk(
+    Bilevel_Writer *w,
+    const char *type,
+    const u8 *data,
+    usize len
+) {
+    u8 header[8];
+    bilevel_put_u32_be(header, (u32)len);
+    memcpy(header + 4, type, 4);
+    u32 crc = bilevel_crc32(0, header + 4, 4);
+    crc = bilevel_crc32(crc, data, len);
+    u8 footer[4];
+    bilevel_put_u32_be(footer, crc);
+    bilevel_put(w, header, sizeof(header));
+    bilevel_put(w, data, len);
+    bilevel_put(w, footer, sizeof(footer));
+}
+
+// Colour type 3 at bit depth 1, with every row unfiltered: packed bits gain
+// little from PNG's byte-wise filters.
+static error bilevel_encode_png(
+    stbi_write_func *func,
+    void *func_ctx,
+    const u8 *data,
+    usize width,
+    usize height,
+    int channels,
+    Palette palette
+) {
+    Bilevel_Writer w = bilevel_writer(func, func_ctx, palette);
+    usize stride = (width + 7) / 8;
+    usize rows_len = (stride + 1) * height;
+    if (rows_len > INT_MAX) return err("image too large for PNG output");
+    u8 *rows = malloc(rows_len);
+    if (rows == NULL) return err("allocation failure");
+    for (usize y = 0; y < height; y += 1) {
+        u8 *row = rows + y * (stride + 1);
+        row[0] = 0;
+        bilevel_pack_row(
+            data + y * width * channels, width, channels, w.colours[1],
+            row + 1, stride
+        );
+    }
+    int zlib_len = 0;
+    u8 *zlib = stbi_zlib_compress(
+        rows, (int)rows_len, &zlib_len, stbi_write_png_compression_level
+    );
+    free(rows);
+    if (zlib == NULL) return err("allocation failure");
+
+    static const u8 signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+    };
+    u8 ihdr[13];
+    bilevel_put_u32_be(ihdr, (u32)width);
+    bilevel_put_u32_be(ihdr + 4, (u32)height);
+    // Bit depth, colour type, compression, filter method, interlacing.
+    u8 ihdr_rest[5] = { 1, 3, 0, 0, 0 };
+    memcpy(ihdr + 8, ihdr_rest, 5);
+    u8 plte[6] = {
+        w.colours[0].r, w.colours[0].g, w.colours[0].b,
+        w.colours[1].r, w.colours[1].g, w.colours[1].b,
+    };
+    bilevel_put(&w, signature, sizeof(signature));
+    bilevel_png_chunk(&w, "IHDR", ihdr, sizeof(ihdr));
+    bilevel_png_chunk(&w, "PLTE", plte, sizeof(plte));
+    bilevel_png_chunk(&w, "IDAT", zlib, (usize)zlib_len);
+    bilevel_png_chunk(&w, "IEND", NULL, 0);
+    free(zlib);
+    return 0;
+}
+
+// Rows run bottom to top, each padded to four bytes.
+static error bilevel_encode_bmp(
+    stbi_write_func *func,
+    void *func_ctx,
+    const u8 *data,
+    usize width,
+    usize height,
+    int channels,
+    Palette palette
+) {
+    Bilevel_Writer w = bilevel_writer(func, func_ctx, palette);
+    usize stride = (width + 31) / 32 * 4;
+    usize pixels_len = stride * height;
+    usize offset = 14 + 40 + 8;
+    if (offset + pixels_len > UINT32_MAX) {
+        return err("image too large for BMP output");
+    }
+    u8 *row = malloc(stride);
+    if (row == NULL) return err("allocation failure");
+
+    u8 header[14 + 40 + 8] = { 'B', 'M' };
+    bilevel_put_u32_le(header + 2, (u32)(offset + pixels_len));
+    bilevel_put_u32_le(header + 10, (u32)offset);
+    u8 *info = header + 14;
+    bilevel_put_u32_le(info, 40);
+    bilevel_put_u32_le(info + 4, (u32)width);
+    bilevel_put_u32_le(info + 8, (u32)height);
+    info[12] = 1;
+    info[14] = 1;
+    bilevel_put_u32_le(info + 20, (u32)pixels_len);
+    bilevel_put_u32_le(info + 32, 2);
+    // The palette, as blue, green, red and a reserved byte.
+    u8 *table = info + 40;
+    for (usize i = 0; i < 2; i += 1) {
+        table[4 * i + 0] = w.colours[i].b;
+        table[4 * i + 1] = w.colours[i].g;
+        table[4 * i + 2] = w.colours[i].r;
+    }
+    bilevel_put(&w, header, sizeof(header));
+    for (usize y = height; y > 0; y -= 1) {
+        bilevel_pack_row(
+            data + (y - 1) * width * channels, width, channels, w.colours[1],
+            row, stride
+        );
+        bilevel_put(&w, row, stride);
+    }
+    free(row);
+    return 0;
+}
+
+// Binary PBM (P4), where set bits are black.
+static error bilevel_encode_pbm(
+    stbi_write_func *func,
+    void *func_ctx,
+    const u8 *data,
+    usize width,
+    usize height,
+    int channels,
+    Palette palette
+) {
+    if (palette.len == 0 || palette.len > 2) {
+        return err("PBM output needs a palette of two colours");
+    }
+    Bilevel_Writer w = bilevel_writer(func, func_ctx, palette);
+    Rgb dark = w.colours[0], light = w.colours[1];
+    if (dark.r + dark.g + dark.b > light.r + light.g + light.b) {
+        dark = w.colours[1];
+    }
+    usize stride = (width + 7) / 8;
+    u8 *row = malloc(stride);
+    if (row == NULL) return err("allocation failure");
+    char header[64];
+    int header_len = snprintf(
+        header, sizeof(header), "P4\n%zu %zu\n", width, height
+    );
+    bilevel_put(&w, header, (usize)header_len);
+    for (usize y = 0; y < height; y += 1) {
+        bilevel_pack_row(
+            data + y * width * channels, width, channels, dark, row, stride
+        );
+        bilevel_put(&w, row, stride);
+    }
+    free(row);
+    return 0;
+}
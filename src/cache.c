@@ -0,0 +1,248 @@
+// Content-addressed output cache (--cache-dir). Each encoded output is stored
+// under a hash of the input file and everything that affects the result, and
+// later runs that would produce the same bytes hard-link (or, across file
+// systems, copy) the stored file into place instead of processing the image.
+//
+// Entries are sharded by the first byte of their key, as `ab/cdef...0.png`.
+// Besides outputs, the cache holds small derived data such as palettes
+// extracted from reference images.
+
+#ifndef _WIN32
+    #include <unistd.h>
+#endif // _WIN32
+
+typedef struct Cache {
+    int fd;
+    // Mixed into every key, so that entries from other versions never match.
+    u64 seed;
+    usize tmp_counter;
+} Cache;
+
+static Str8 cache_format_ext(Format format) {
+    switch (format) {
+        case FORMAT_JPG: return str8("jpg");
+        case FORMAT_PNG: return str8("png");
+        case FORMAT_BMP: return str8("bmp");
+        case FORMAT_GIF: return str8("gif");
+        case FORMAT_PBM: return str8("pbm");
+    }
+    return str8("bin");
+}
+
+#define cache_name_cap 64
+
+static void cache_name(u64 key, Str8 ext, char *out) {
+    snprintf(
+        out, cache_name_cap, "%02x/%014llx.%.*s",
+        (unsigned)(key >> 56), (unsigned long long)(key & 0xffffffffffffffull),
+        str8_fmt(ext)
+    );
+}
+
+#ifndef _WIN32
+
+static error cache_open(Str8 path, Str8 version, Cache *out) {
+    if (mkdir((char *)path.ptr, 0777) != 0 && errno != EEXIST) {
+        return errf("failed to create directory '%.*s'", str8_fmt(path));
+    }
+    int fd = open((char *)path.ptr, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return errf("failed to open directory '%.*s'", str8_fmt(path));
+    *out = (Cache){ .fd = fd, .seed = hash64(version.ptr, version.len, 0) };
+    return 0;
+}
+
+static void cache_close(Cache *cache) {
+    close(cache->fd);
+}
+
+static error cache_write_all(int fd, const u8 *data, usize len) {
+    for (usize written = 0; written < len;) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return 1;
+        written += (usize)n;
+    }
+    return 0;
+}
+
+static error cache_copy(
+    int from_fd,
+    const char *from,
+    int to_fd,
+    const char *to
+) {
+    int in = openat(from_fd, from, O_RDONLY);
+    if (in < 0) return 1;
+    int out = openat(to_fd, to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+        close(in);
+        return 1;
+    }
+
+    error e = 0;
+    u8 buf[64 * 1024];
+    for (;;) {
+        ssize_t read_len = read(in, buf, sizeof(buf));
+        if (read_len < 0 && errno == EINTR) continue;
+        if (read_len <= 0) {
+            e = read_len < 0;
+            break;
+        }
+        e = cache_write_all(out, buf, (usize)read_len);
+        if (e != 0) break;
+    }
+    close(in);
+    if (close(out) != 0) e = 1;
+    if (e != 0) unlinkat(to_fd, to, 0);
+    return e;
+}
+
+static void cache_tmp_name(Cache *cache, const char *name, char *out) {
+    snprintf(
+        out, cache_name_cap + 32, "%s.%ld.%zu.tmp",
+        name, (long)getpid(), atom_add(&cache->tmp_counter, 1)
+    );
+}
+
+// Places the entry for `key`, if there is one, at `out_name`, which is relative
+// to `out_dir` if given. Returns false on a miss.
+static bool cache_fetch(
+    Cache *cache,
+    u64 key,
+    Format format,
+    Dir_Ref *out_dir,
+    const char *out_name
+) {
+    int out_fd = out_dir != NULL ? out_dir->out_fd : AT_FDCWD;
+    char name[cache_name_cap];
+    cache_name(key, cache_format_ext(format), name);
+    if (faccessat(cache->fd, name, F_OK, 0) != 0) return false;
+
+    if (unlinkat(out_fd, out_name, 0) != 0 && errno != ENOENT) return false;
+    if (linkat(cache->fd, name, out_fd, out_name, 0) == 0) return true;
+    return cache_copy(cache->fd, name, out_fd, out_name) == 0;
+}
+
+// Outputs served from the cache share their inode with the entry, so they are
+// replaced rather than overwritten in place. Any file with other hard links is
+// treated this way, which also protects entries in runs without --cache-dir.
+static void cache_detach(Dir_Ref *out_dir, const char *out_name) {
+    int out_fd = out_dir != NULL ? out_dir->out_fd : AT_FDCWD;
+    struct stat st;
+    if (fstatat(out_fd, out_name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+    if (S_ISREG(st.st_mode) && st.st_nlink > 1) unlinkat(out_fd, out_name, 0);
+}
+
+// Adds a freshly written output to the cache. Failures only cost a later
+// cache hit, so they are not reported.
+static void cache_store(
+    Cache *cache,
+    u64 key,
+    Format format,
+    Dir_Ref *out_dir,
+    const char *out_name
+) {
+    int out_fd = out_dir != NULL ? out_dir->out_fd : AT_FDCWD;
+    char name[cache_name_cap];
+    cache_name(key, cache_format_ext(format), name);
+    char shard[3] = { name[0], name[1], '\0' };
+    mkdirat(cache->fd, shard, 0777);
+    if (linkat(out_fd, out_name, cache->fd, name, 0) == 0) return;
+    if (errno == EEXIST) return;
+
+    // Copy to a unique name first, so that readers never see a partial entry.
+    char tmp_name[cache_name_cap + 32]; cache_tmp_name(cache, name, tmp_name);
+    if (cache_copy(out_fd, out_name, cache->fd, tmp_name) != 0) return;
+    if (renameat(cache->fd, tmp_name, cache->fd, name) != 0) {
+        unlinkat(cache->fd, tmp_name, 0);
+    }
+}
+
+// Reads the whole entry for `key` into `arena`. Returns false on a miss.
+static bool cache_load(
+    Cache *cache,
+    u64 key,
+    Str8 ext,
+    Arena *arena,
+    Str8 *out
+) {
+    char name[cache_name_cap]; cache_name(key, ext, name);
+    int fd = openat(cache->fd, name, O_RDONLY);
+    if (fd < 0) return false;
+    FILE *file = fdopen(fd, "rb");
+    if (file == NULL) {
+        close(fd);
+        return false;
+    }
+    error e = file_read_from(arena, file, out);
+    fclose(file);
+    return e == 0;
+}
+
+// Stores `data` as the entry for `key`, unreported on failure like
+// cache_store.
+static void cache_save(Cache *cache, u64 key, Str8 ext, Str8 data) {
+    char name[cache_name_cap]; cache_name(key, ext, name);
+    char shard[3] = { name[0], name[1], '\0' };
+    mkdirat(cache->fd, shard, 0777);
+
+    char tmp_name[cache_name_cap + 32]; cache_tmp_name(cache, name, tmp_name);
+    int fd = openat(cache->fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return;
+    error e = cache_write_all(fd, data.ptr, data.len);
+    if (close(fd) != 0) e = 1;
+    if (e != 0 || renameat(cache->fd, tmp_name, cache->fd, name) != 0) {
+        unlinkat(cache->fd, tmp_name, 0);
+    }
+}
+
+#else
+
+static error cache_open(Str8 path, Str8 version, Cache *out) {
+    (void)path; (void)version; (void)out;
+    return err("--cache-dir is not supported on this platform");
+}
+
+static void cache_close(Cache *cache) { (void)cache; }
+
+static bool cache_fetch(
+    Cache *cache,
+    u64 key,
+    Format format,
+    Dir_Ref *out_dir,
+    const char *out_name
+) {
+    (void)cache; (void)key; (void)format; (void)out_dir; (void)out_name;
+    return false;
+}
+
+static void cache_detach(Dir_Ref *out_dir, const char *out_name) {
+    (void)out_dir; (void)out_name;
+}
+
+static void cache_store(
+    Cache *cache,
+    u64 key,
+    Format format,
+    Dir_Ref *out_dir,
+    const char *out_name
+) {
+    (void)cache; (void)key; (void)format; (void)out_dir; (void)out_name;
+}
+
+static bool cache_load(
+    Cache *cache,
+    u64 key,
+    Str8 ext,
+    Arena *arena,
+    Str8 *out
+) {
+    (void)cache; (void)key; (void)ext; (void)arena; (void)out;
+    return false;
+}
+
+static void cache_save(Cache *cache, u64 key, Str8 ext, Str8 data) {
+    (void)cache; (void)key; (void)ext; (void)data;
+}
+
+#endif // _WIN32
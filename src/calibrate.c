@@ -0,0 +1,127 @@
+// Keeps the fastest search per palette size, as timed by measure.c, in a file
+// that later runs of `imgclr` load into the dispatch table, in place of its
+// defaults.
+
+#ifdef _WIN32
+    #include <direct.h>
+    #define calibrate_mkdir(path) _mkdir(path)
+#else
+    #include <sys/stat.h>
+    #define calibrate_mkdir(path) mkdir(path, 0777)
+#endif // _WIN32
+
+#define calibrate_header "imgclr-calibration 1"
+
+// $IMGCLR_CALIBRATION, or a file in the user's configuration directory.
+// Returns false where there is neither.
+static bool calibrate_path(Arena *arena, Str8 *out) {
+    char *path = getenv("IMGCLR_CALIBRATION");
+    if (path != NULL && path[0] != '\0') {
+        *out = str8_from_cstr(path);
+        return true;
+    }
+    #ifdef _WIN32
+        char *base = getenv("APPDATA");
+        const char *suffix = "\\imgclr\\calibration";
+    #else
+        char *base = getenv("XDG_CONFIG_HOME");
+        const char *suffix = "/imgclr/calibration";
+        if (base == NULL || base[0] == '\0') {
+            base = getenv("HOME");
+            suffix = "/.config/imgclr/calibration";
+        }
+    #endif // _WIN32
+    if (base == NULL || base[0] == '\0') return false;
+    usize len = strlen(base) + strlen(suffix);
+    if (arena_alloc(arena, len + 1, &out->ptr) != 0) return false;
+    snprintf((char *)out->ptr, len + 1, "%s%s", base, suffix);
+    out->len = len;
+    return true;
+}
+
+// Sets the dispatch table from the calibration file, if there is one.
+static error calibrate_load(Arena *arena) {
+    Str8 path;
+    if (!calibrate_path(arena, &path)) return 0;
+    FILE *file = fopen((char *)path.ptr, "rb");
+    if (file == NULL) return 0;
+
+    Search_Kind table[search_table_len];
+    memcpy(table, search_table, sizeof(table));
+    char line[64];
+    bool valid = fgets(line, sizeof(line), file) != NULL &&
+        strncmp(line, calibrate_header, strlen(calibrate_header)) == 0;
+    while (valid && fgets(line, sizeof(line), file) != NULL) {
+        usize palette_len;
+        char name[16];
+        valid = sscanf(line, "%zu %15s", &palette_len, name) == 2 &&
+            palette_len <= search_palette_max;
+        usize kind = 0;
+        while (valid && kind < SEARCH_KINDS_LEN &&
+            strcmp(name, search_kind_names[kind]) != 0
+        ) {
+            kind += 1;
+        }
+        valid = valid && kind < SEARCH_KINDS_LEN &&
+            search_kind_supports(kind, palette_len);
+        if (valid) table[search_table_index(palette_len)] = kind;
+    }
+    fclose(file);
+    if (!valid) return errf(
+        "invalid calibration file '%.*s'; run --calibrate again",
+        str8_fmt(path)
+    );
+    memcpy(search_table, table, sizeof(table));
+    return 0;
+}
+
+// Creates the directories leading to `path`, where they do not exist yet.
+static void calibrate_mkdirs(Str8 path) {
+    char *s = (char *)path.ptr;
+    for (usize i = 1; i < path.len; i += 1) {
+        if (s[i] != '/' && s[i] != '\\') continue;
+        char sep = s[i];
+        s[i] = '\0';
+        calibrate_mkdir(s);
+        s[i] = sep;
+    }
+}
+
+static error calibrate_save(Arena *arena, Str8 *path) {
+    if (!calibrate_path(arena, path)) {
+        return err("no configuration directory for the calibration file");
+    }
+    // Copied, as calibrate_mkdirs() writes to it.
+    path->ptr = (u8 *)cstr_from_str8(arena, *path);
+    calibrate_mkdirs(*path);
+
+    FILE *file = NULL;
+    try (file_open(*path, "wb", &file));
+    fprintf(file, "%s\n", calibrate_header);
+    for (usize i = 0; i < search_table_len; i += 1) {
+        fprintf(
+            file, "%zu %s\n",
+            i == search_table_len - 1 ? search_palette_max : (usize)1 << i,
+            search_kind_names[search_table[i]]
+        );
+    }
+    if (fclose(file) != 0) {
+        return errf("error writing '%.*s'", str8_fmt(*path));
+    }
+    return 0;
+}
+
+// Measures on photograph-like pixels, which is what most inputs resemble.
+static error calibrate_run(Arena *arena) {
+    Measure_Row rows[search_table_len];
+    try (measure_searches(MEASURE_PHOTO, 3, rows));
+    printf("%s pixels:\n", measure_pixels_names[MEASURE_PHOTO]);
+    measure_print(stdout, rows);
+    for (usize i = 0; i < search_table_len; i += 1) {
+        search_table[i] = rows[i].fastest;
+    }
+    Str8 path;
+    try (calibrate_save(arena, &path));
+    printf("wrote '%.*s'\n", str8_fmt(path));
+    return 0;
+}
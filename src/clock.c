@@ -0,0 +1,22 @@
+// A monotonic clock in nanoseconds, for --stats, --calibrate and the
+// benchmark.
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif // _WIN32
+
+static u64 clock_now(void) {
+    #ifdef _WIN32
+        LARGE_INTEGER freq, count;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&count);
+        return (u64)((f64)count.QuadPart * 1e9 / (f64)freq.QuadPart);
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+    #endif // _WIN32
+}
@@ -1,5 +1,7 @@
 typedef struct { u8 r, g, b; } Rgb;
 
+typedef Slice(Rgb) Palette;
+
 const bool is_hex_char_table[256] = {
     ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, 
     ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1, 
@@ -39,3 +41,30 @@ static error rgb_from_hex_str8(Str8 s, Rgb *out) {
     }
     return 0;
 }
+
+static maybe_unused error palette_from_hex_strs(
+    Arena *arena,
+    char **hex_strs,
+    usize hex_strs_len,
+    Palette *out
+) {
+    if (hex_strs_len < 2) {
+        return err("expected at least two (2) palette colours");
+    }
+    try (arena_alloc(arena, hex_strs_len * sizeof(Rgb), &out->ptr));
+    out->len = 0;
+    for (usize i = 0; i < hex_strs_len; i += 1) {
+        Str8 hex_str = str8_from_cstr(hex_strs[i]);
+        Rgb rgb; try (rgb_from_hex_str8(hex_str, &rgb));
+        slice_push(*out, rgb);
+    }
+    return 0;
+}
+
+static maybe_unused bool palette_is_grey(Palette palette) {
+    for (usize i = 0; i < palette.len; i += 1) {
+        Rgb c = palette.ptr[i];
+        if (c.r != c.g || c.g != c.b) return false;
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+// A pair of open input/output directories. Files are opened relative to these
+// descriptors (openat), so the kernel never re-resolves the full path of each
+// image. Jobs hold a reference until their output is written.
+
+#ifndef _WIN32
+    #include <dirent.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#endif // _WIN32
+
+typedef struct Dir_Ref {
+    int in_fd;
+    int out_fd;
+    usize refs;
+} Dir_Ref;
+
+#ifndef _WIN32
+
+static void dir_ref_release(Dir_Ref *dir) {
+    if (dir == NULL || atom_sub(&dir->refs, 1) != 1) return;
+    close(dir->in_fd);
+    close(dir->out_fd);
+    free(dir);
+}
+
+static error dir_ref_new(int in_fd, int out_fd, Dir_Ref **out) {
+    Dir_Ref *dir = malloc(sizeof(Dir_Ref));
+    if (dir == NULL) return err("allocation failure");
+    *dir = (Dir_Ref){ .in_fd = in_fd, .out_fd = out_fd, .refs = 1 };
+    *out = dir;
+    return 0;
+}
+
+static error dir_open_file(
+    Dir_Ref *dir,
+    Str8 name,
+    bool write,
+    Str8 display_path,
+    FILE **out
+) {
+    int fd = write ?
+        openat(
+            dir->out_fd, (char *)name.ptr, O_WRONLY | O_CREAT | O_TRUNC, 0666
+        ) :
+        openat(dir->in_fd, (char *)name.ptr, O_RDONLY);
+    if (fd < 0) {
+        return errf("failed to open file '%.*s'", str8_fmt(display_path));
+    }
+    FILE *file = fdopen(fd, write ? "wb" : "rb");
+    if (file == NULL) {
+        close(fd);
+        return errf("failed to open file '%.*s'", str8_fmt(display_path));
+    }
+    *out = file;
+    return 0;
+}
+
+#else
+
+static void dir_ref_release(Dir_Ref *dir) { (void)dir; }
+
+static error dir_open_file(
+    Dir_Ref *dir,
+    Str8 name,
+    bool write,
+    Str8 display_path,
+    FILE **out
+) {
+    (void)dir; (void)name; (void)write; (void)display_path; (void)out;
+    return err("directory processing is not supported on this platform");
+}
+
+#endif // _WIN32
@@ -79,3 +79,23 @@ Dither_Error sierra_lite_offsets[] = {
     { 0, 1, 1.0/4.0},
 };
 const Dither_Algorithm sierra_lite = slice(sierra_lite_offsets);
+
+static maybe_unused error dither_algorithm_from_str8(
+    Str8 s,
+    Dither_Algorithm *out
+) {
+    if (str8_eql(s, str8("floyd-steinberg"))) {
+        *out = floyd_steinberg;
+    } else if (str8_eql(s, str8("none"))) {
+        *out = none;
+    } else if (str8_eql(s, str8("atkinson"))) {
+        *out = atkinson;
+    } else if (str8_eql(s, str8("jjn"))) {
+        *out = jjn;
+    } else if (str8_eql(s, str8("burkes"))) {
+        *out = burkes;
+    } else if (str8_eql(s, str8("sierra-lite"))) {
+        *out = sierra_lite;
+    } else return errf("invalid algorithm '%.*s'", str8_fmt(s));
+    return 0;
+}
@@ -0,0 +1,303 @@
+// GIF89a encoder for quantised images. The colour table is built from the
+// colours actually present, so any image with at most 256 distinct colours
+// (255 when some pixels are transparent) can be written losslessly.
+
+#define gif_max_code 4095
+#define gif_dict_cap 8192
+
+typedef struct Gif_Writer {
+    stbi_write_func *func;
+    void *ctx;
+    u8 block[256];
+    u32 bits;
+    u32 bits_len;
+} Gif_Writer;
+
+static void gif_put(Gif_Writer *w, const void *data, int len) {
+    w->func(w->ctx, (void *)data, len);
+}
+
+static void gif_put_u16(Gif_Writer *w, u16 value) {
+    u8 bytes[2] = { (u8)(value & 0xff), (u8)(value >> 8) };
+    gif_put(w, bytes, 2);
+}
+
+static void gif_flush_block(Gif_Writer *w) {
+    if (w->block[0] == 0) return;
+    gif_put(w, w->block, 1 + w->block[0]);
+    w->block[0] = 0;
+}
+
+static void gif_put_code(Gif_Writer *w, u32 code, u32 code_size) {
+    w->bits |= code << w->bits_len;
+    w->bits_len += code_size;
+    while (w->bits_len >= 8) {
+        w->block[1 + w->block[0]] = (u8)(w->bits & 0xff);
+        w->block[0] += 1;
+        if (w->block[0] == 255) gif_flush_block(w);
+        w->bits >>= 8;
+        w->bits_len -= 8;
+    }
+}
+
+// Maps (prefix code, next index) pairs to codes for the LZW dictionary.
+typedef struct Gif_Dict {
+    u32 keys[gif_dict_cap];
+    u16 codes[gif_dict_cap];
+} Gif_Dict;
+
+static usize gif_dict_slot(Gif_Dict *dict, u32 key) {
+    usize slot = (key * 2654435761u) >> (32 - 13);
+    while (dict->keys[slot] != 0 && dict->keys[slot] != key) {
+        slot = (slot + 1) & (gif_dict_cap - 1);
+    }
+    return slot;
+}
+
+// Variable-width LZW as specified by GIF89a, widening codes and clearing the
+// dictionary at the same points as the reference decoder.
+static void gif_put_indices(
+    Gif_Writer *w,
+    Gif_Dict *dict,
+    const u8 *indices,
+    usize len,
+    u32 min_code_size
+) {
+    u32 clear_code = 1u << min_code_size;
+    u32 end_code = clear_code + 1;
+    u32 next_code = end_code + 1;
+    u32 code_size = min_code_size + 1;
+    memset(dict->keys, 0, sizeof(dict->keys));
+
+    u8 min_code_size_byte = (u8)min_code_size;
+    gif_put(w, &min_code_size_byte, 1);
+    gif_put_code(w, clear_code, code_size);
+
+    u32 prefix = indices[0];
+    for (usize i = 1; i < len; i += 1) {
+        // Keys are offset by one so that zero marks an empty slot.
+        u32 key = ((prefix << 8) | indices[i]) + 1;
+        usize slot = gif_dict_slot(dict, key);
+        if (dict->keys[slot] == key) {
+            prefix = dict->codes[slot];
+            continue;
+        }
+
+        gif_put_code(w, prefix, code_size);
+        if (next_code >= (1u << code_size) && code_size < 12) code_size += 1;
+        if (next_code >= gif_max_code) {
+            gif_put_code(w, clear_code, code_size);
+            next_code = end_code + 1;
+            code_size = min_code_size + 1;
+            memset(dict->keys, 0, sizeof(dict->keys));
+        } else {
+            dict->keys[slot] = key;
+            dict->codes[slot] = (u16)next_code;
+            next_code += 1;
+        }
+        prefix = indices[i];
+    }
+
+    gif_put_code(w, prefix, code_size);
+    if (next_code >= (1u << code_size) && code_size < 12) code_size += 1;
+    gif_put_code(w, end_code, code_size);
+    if (w->bits_len > 0) gif_put_code(w, 0, 8 - w->bits_len);
+    gif_flush_block(w);
+    u8 terminator = 0;
+    gif_put(w, &terminator, 1);
+}
+
+// Open-addressed map from packed RGB to colour table index.
+typedef struct Gif_Colours {
+    u32 keys[1024];
+    u8 indices[1024];
+    Rgb table[256];
+    usize len;
+} Gif_Colours;
+
+static usize gif_colours_slot(Gif_Colours *colours, u32 key) {
+    usize slot = (key * 2654435761u) >> (32 - 10);
+    while (colours->keys[slot] != 0 && colours->keys[slot] != key) {
+        slot = (slot + 1) & 1023;
+    }
+    return slot;
+}
+
+static error gif_colours_add(
+    Gif_Colours *colours,
+    const u8 *pixel,
+    usize cap,
+    u8 *index
+) {
+    u32 key = (((u32)pixel[0] << 16) | ((u32)pixel[1] << 8) | pixel[2]) + 1;
+    usize slot = gif_colours_slot(colours, key);
+    if (colours->keys[slot] != key) {
+        if (colours->len == cap) return errf(
+            "GIF output supports at most %zu colours", cap
+        );
+        colours->keys[slot] = key;
+        colours->indices[slot] = (u8)colours->len;
+        colours->table[colours->len] = (Rgb){
+            .r = pixel[0], .g = pixel[1], .b = pixel[2],
+        };
+        colours->len += 1;
+    }
+    *index = colours->indices[slot];
+    return 0;
+}
+
+// Writes `frames_len` consecutive RGB frames. `delays` gives each frame's
+// duration in milliseconds and may be NULL for a still image; pixels whose
+// `alpha` mask byte is set are written as transparent, and `alpha` may be
+// NULL when there are none.
+static error gif_encode(
+    stbi_write_func *func,
+    void *func_ctx,
+    const u8 *data,
+    int width,
+    int height,
+    usize frames_len,
+    const int *delays,
+    const u8 *alpha
+) {
+    if (width > 0xffff || height > 0xffff) {
+        return err("image is too large for GIF output");
+    }
+    usize frame_pixels = (usize)width * (usize)height;
+    usize pixels_len = frame_pixels * frames_len;
+
+    bool has_alpha = false;
+    for (usize i = 0; alpha != NULL && i < pixels_len && !has_alpha; i += 1) {
+        has_alpha = alpha[i] != 0;
+    }
+
+    Gif_Colours *colours = calloc(1, sizeof(Gif_Colours));
+    Gif_Dict *dict = malloc(sizeof(Gif_Dict));
+    u8 *indices = malloc(frame_pixels);
+    error e = 0;
+    if (colours == NULL || dict == NULL || indices == NULL) {
+        e = err("allocation failure");
+        goto done;
+    }
+
+    // Collect the colour table up front, as it precedes every frame.
+    usize colours_cap = has_alpha ? 255 : 256;
+    for (usize i = 0; i < pixels_len && e == 0; i += 1) {
+        if (has_alpha && alpha[i] != 0) continue;
+        u8 index;
+        e = gif_colours_add(colours, data + 3 * i, colours_cap, &index);
+    }
+    if (e != 0) goto done;
+    u8 transparent_index = (u8)colours->len;
+
+    u32 table_bits = 1;
+    usize table_len_needed = colours->len + (has_alpha ? 1 : 0);
+    while ((1u << table_bits) < table_len_needed) table_bits += 1;
+
+    Gif_Writer w = { .func = func, .ctx = func_ctx };
+    gif_put(&w, "GIF89a", 6);
+    gif_put_u16(&w, (u16)width);
+    gif_put_u16(&w, (u16)height);
+    u8 screen[3] = { (u8)(0x80 | 0x70 | (table_bits - 1)), 0, 0 };
+    gif_put(&w, screen, 3);
+    for (usize i = 0; i < (1u << table_bits); i += 1) {
+        Rgb colour = i < colours->len ? colours->table[i] : (Rgb){ 0 };
+        gif_put(&w, &colour, 3);
+    }
+
+    if (frames_len > 1) {
+        // Loop forever.
+        u8 netscape[19] = {
+            0x21, 0xff, 0x0b,
+            'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+            0x03, 0x01, 0x00, 0x00, 0x00,
+        };
+        gif_put(&w, netscape, sizeof(netscape));
+    }
+
+    for (usize frame_i = 0; frame_i < frames_len; frame_i += 1) {
+        const u8 *frame = data + 3 * frame_pixels * frame_i;
+        const u8 *frame_alpha =
+            has_alpha ? alpha + frame_pixels * frame_i : NULL;
+
+        if (frames_len > 1 || has_alpha) {
+            int delay_cs = delays == NULL ? 0 : delays[frame_i] / 10;
+            clamp(delay_cs, 0, 0xffff);
+            // Frames are complete images, so transparent areas must be
+            // cleared rather than show the previous frame through.
+            u8 disposal = has_alpha ? 2 : 1;
+            u8 control[4] = {
+                0x21, 0xf9, 0x04, (u8)((disposal << 2) | (has_alpha ? 1 : 0)),
+            };
+            gif_put(&w, control, 4);
+            gif_put_u16(&w, (u16)delay_cs);
+            u8 control_end[2] = { transparent_index, 0 };
+            gif_put(&w, control_end, 2);
+        }
+
+        u8 descriptor[5] = { 0x2c, 0, 0, 0, 0 };
+        gif_put(&w, descriptor, 5);
+        gif_put_u16(&w, (u16)width);
+        gif_put_u16(&w, (u16)height);
+        u8 packed = 0;
+        gif_put(&w, &packed, 1);
+
+        u8 last_index = 0;
+        u32 last_key = 0;
+        for (usize i = 0; i < frame_pixels; i += 1) {
+            if (frame_alpha != NULL && frame_alpha[i] != 0) {
+                indices[i] = transparent_index;
+                continue;
+            }
+            const u8 *pixel = frame + 3 * i;
+            u32 key =
+                (((u32)pixel[0] << 16) | ((u32)pixel[1] << 8) | pixel[2]) + 1;
+            if (key != last_key) {
+                last_key = key;
+                last_index = colours->indices[gif_colours_slot(colours, key)];
+            }
+            indices[i] = last_index;
+        }
+        u32 min_code_size = table_bits < 2 ? 2 : table_bits;
+        gif_put_indices(&w, dict, indices, frame_pixels, min_code_size);
+    }
+
+    u8 trailer = 0x3b;
+    gif_put(&w, &trailer, 1);
+
+done:
+    free(colours);
+    free(dict);
+    free(indices);
+    return e;
+}
+
+// Counts the images in a GIF by walking its blocks, without decoding them.
+// Stops at the trailer or wherever the data runs out, as the decoder does.
+static maybe_unused usize gif_frames_len(Str8 gif) {
+    if (gif.len < 13) return 0;
+    usize i = 13;
+    // Global colour table.
+    if (gif.ptr[10] & 0x80) i += 3u << ((gif.ptr[10] & 7) + 1);
+    usize frames_len = 0;
+    while (i < gif.len && gif.ptr[i] != 0x3b) {
+        if (gif.ptr[i] == 0x2c) {
+            if (i + 10 > gif.len) break;
+            frames_len += 1;
+            u8 flags = gif.ptr[i + 9];
+            // Descriptor, local colour table and LZW code size.
+            i += 10;
+            if (flags & 0x80) i += 3u << ((flags & 7) + 1);
+            i += 1;
+        } else if (gif.ptr[i] == 0x21) {
+            // Introducer and label.
+            i += 2;
+        } else {
+            break;
+        }
+        // Data sub-blocks, up to an empty one.
+        while (i < gif.len && gif.ptr[i] != 0) i += 1 + gif.ptr[i];
+        i += 1;
+    }
+    return frames_len;
+}
@@ -0,0 +1,78 @@
+// Fast non-cryptographic 64-bit hash (the XXH64 algorithm), for identifying
+// content rather than guarding against deliberate collisions.
+
+#define hash_prime_1 0x9e3779b185ebca87ull
+#define hash_prime_2 0xc2b2ae3d27d4eb4full
+#define hash_prime_3 0x165667b19e3779f9ull
+#define hash_prime_4 0x85ebca77c2b2ae63ull
+#define hash_prime_5 0x27d4eb2f165667c5ull
+
+static u64 hash_rotl(u64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static u64 hash_read_u64(const u8 *p) {
+    u64 x; memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static u64 hash_read_u32(const u8 *p) {
+    u32 x; memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static u64 hash_round(u64 acc, u64 input) {
+    acc += input * hash_prime_2;
+    return hash_rotl(acc, 31) * hash_prime_1;
+}
+
+static u64 hash_merge(u64 acc, u64 lane) {
+    acc ^= hash_round(0, lane);
+    return acc * hash_prime_1 + hash_prime_4;
+}
+
+static u64 hash64(const void *data, usize len, u64 seed) {
+    const u8 *p = data;
+    const u8 *end = p + len;
+    u64 h;
+
+    if (len >= 32) {
+        u64 lanes[4] = {
+            seed + hash_prime_1 + hash_prime_2,
+            seed + hash_prime_2,
+            seed,
+            seed - hash_prime_1,
+        };
+        for (; end - p >= 32; p += 32) {
+            lanes[0] = hash_round(lanes[0], hash_read_u64(p + 0));
+            lanes[1] = hash_round(lanes[1], hash_read_u64(p + 8));
+            lanes[2] = hash_round(lanes[2], hash_read_u64(p + 16));
+            lanes[3] = hash_round(lanes[3], hash_read_u64(p + 24));
+        }
+        h = hash_rotl(lanes[0], 1) + hash_rotl(lanes[1], 7) +
+            hash_rotl(lanes[2], 12) + hash_rotl(lanes[3], 18);
+        for (usize i = 0; i < 4; i += 1) h = hash_merge(h, lanes[i]);
+    } else {
+        h = seed + hash_prime_5;
+    }
+
+    h += (u64)len;
+    for (; end - p >= 8; p += 8) {
+        h ^= hash_round(0, hash_read_u64(p));
+        h = hash_rotl(h, 27) * hash_prime_1 + hash_prime_4;
+    }
+    if (end - p >= 4) {
+        h ^= hash_read_u32(p) * hash_prime_1;
+        h = hash_rotl(h, 23) * hash_prime_2 + hash_prime_3;
+        p += 4;
+    }
+    for (; p < end; p += 1) {
+        h ^= *p * hash_prime_5;
+        h = hash_rotl(h, 11) * hash_prime_1;
+    }
+
+    h ^= h >> 33;
+    h *= hash_prime_2;
+    h ^= h >> 29;
+    h *= hash_prime_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,752 @@
+typedef enum {
+    FORMAT_JPG,
+    FORMAT_PNG,
+    FORMAT_BMP,
+    FORMAT_GIF,
+    // Output only, and only for two colours.
+    FORMAT_PBM,
+} Format;
+
+static error format_from_ext(Str8 ext, Format *format) {
+    if (str8_eql(ext, str8("jpg")) || str8_eql(ext, str8("JPG")) ||
+        str8_eql(ext, str8("jpeg")) || str8_eql(ext, str8("JPEG"))
+    ) {
+        *format = FORMAT_JPG;
+    } else if (str8_eql(ext, str8("png")) || str8_eql(ext, str8("PNG"))) {
+        *format = FORMAT_PNG;
+    } else if (str8_eql(ext, str8("bmp")) || str8_eql(ext, str8("BMP")) ||
+        str8_eql(ext, str8("dib")) || str8_eql(ext, str8("DIB"))
+    ) {
+        *format = FORMAT_BMP;
+    } else if (str8_eql(ext, str8("gif")) || str8_eql(ext, str8("GIF"))) {
+        *format = FORMAT_GIF;
+    } else if (str8_eql(ext, str8("pbm")) || str8_eql(ext, str8("PBM"))) {
+        *format = FORMAT_PBM;
+    } else return errf(
+        "extension '%.*s' does not match any supported image format",
+        str8_fmt(ext)
+    );
+
+    return 0;
+}
+
+static maybe_unused error format_from_str(Str8 str, Format *format) {
+    usize extension_pos = str.len;
+    for (usize i = str.len; i > 0; i -= 1) {
+        if (str.ptr[i - 1] != '.') continue;
+        extension_pos = i;
+        break;
+    }
+
+    if (extension_pos + 1 >= str.len) return errf(
+        "unable to infer image format from filename '%.*s'",
+        str8_fmt(str)
+    );
+
+    return format_from_ext(str8_range(str, extension_pos, str.len), format);
+}
+
+// The format of encoded image data, from its first bytes.
+static maybe_unused bool format_from_magic(Str8 data, Format *format) {
+    if (data.len >= 3 && memcmp(data.ptr, "\xff\xd8\xff", 3) == 0) {
+        *format = FORMAT_JPG;
+    } else if (data.len >= 4 && memcmp(data.ptr, "\x89PNG", 4) == 0) {
+        *format = FORMAT_PNG;
+    } else if (data.len >= 2 && memcmp(data.ptr, "BM", 2) == 0) {
+        *format = FORMAT_BMP;
+    } else if (data.len >= 4 && memcmp(data.ptr, "GIF8", 4) == 0) {
+        *format = FORMAT_GIF;
+    } else return false;
+    return true;
+}
+
+// Packs RGBA pixels down to RGB in place. If any pixel is mostly transparent,
+// `*alpha` is set to a newly allocated mask with a non-zero byte for each such
+// pixel; otherwise it is left NULL.
+static maybe_unused error image_rgb_from_rgba(
+    u8 *data,
+    usize pixels_len,
+    u8 **alpha
+) {
+    *alpha = NULL;
+    for (usize i = 0; i < pixels_len; i += 1) {
+        if (data[4 * i + 3] < 128) {
+            if (*alpha == NULL) {
+                *alpha = calloc(pixels_len, 1);
+                if (*alpha == NULL) return err("allocation failure");
+            }
+            (*alpha)[i] = 1;
+        }
+        data[3 * i + 0] = data[4 * i + 0];
+        data[3 * i + 1] = data[4 * i + 1];
+        data[3 * i + 2] = data[4 * i + 2];
+    }
+    return 0;
+}
+
+static void image_invert(u8 *data, usize data_len) {
+    for (usize i = 0; i < data_len; i += 3) {
+        i16 brightness = (data[i + 0] + data[i + 1] + data[i + 2]) / 3;
+        i16 r_relative = data[i + 0] - brightness;
+        i16 g_relative = data[i + 1] - brightness;
+        i16 b_relative = data[i + 2] - brightness;
+
+        i16 new_r = (255 - brightness) + r_relative;
+        i16 new_g = (255 - brightness) + g_relative;
+        i16 new_b = (255 - brightness) + b_relative;
+
+        clamp(new_r, 0, 255);
+        clamp(new_g, 0, 255);
+        clamp(new_b, 0, 255);
+
+        data[i + 0] = (u8)new_r;
+        data[i + 1] = (u8)new_g;
+        data[i + 2] = (u8)new_b;
+    }
+}
+
+// Nearest palette index for each 24-bit colour, filled in as colours are met
+// so that it can be kept across images quantised to the same palette. Entries
+// hold the index plus one, leaving zero for colours not yet seen, which limits
+// it to palettes of up to 255 colours.
+#define image_memo_len ((usize)1 << 24)
+#define image_memo_palette_max 255
+
+// Quantises the first `rows` of `height` rows, diffusing error into any of
+// them. The rest are left for a later call, which lets an image be quantised
+// strip by strip with the same result as all at once.
+// NOTE (OUTDATED): Having several loops to avoid bounds checking on the
+// majority of the image is not worth it.
+static void image_quantise_strip(
+    u8 *data,
+    usize width,
+    usize rows,
+    usize height,
+    const Search *search,
+    Dither_Algorithm algorithm,
+    u8 *memo
+) {
+    const usize channels = 3;
+    Palette palette = search->palette;
+    usize data_len = width * rows * channels;
+    for (usize i = 0; i < data_len; i += channels) {
+        u32 key = ((u32)data[i + 0] << 16) | ((u32)data[i + 1] << 8) |
+            data[i + 2];
+        usize best_match = 0;
+        if (memo != NULL && memo[key] != 0) {
+            best_match = memo[key] - 1;
+        } else {
+            best_match = search_nearest(search, data + i);
+            if (memo != NULL) memo[key] = (u8)(best_match + 1);
+        }
+
+        i16 quant_err[3] = {
+            (i16)data[i + 0] - palette.ptr[best_match].r,
+            (i16)data[i + 1] - palette.ptr[best_match].g,
+            (i16)data[i + 2] - palette.ptr[best_match].b
+        };
+
+        data[i + 0] = palette.ptr[best_match].r;
+        data[i + 1] = palette.ptr[best_match].g;
+        data[i + 2] = palette.ptr[best_match].b;
+
+        usize current_x = (i / channels) % width;
+        usize current_y = (i / channels) / width;
+        for (usize j = 0; j < algorithm.len; j++) {
+            i64 target_x = current_x + algorithm.ptr[j].x_offset;
+            i64 target_y = current_y + algorithm.ptr[j].y_offset;
+            if (target_x < 0 || target_x >= (i64)width ||
+                target_y < 0 || target_y >= (i64)height
+            ) {
+                continue;
+            }
+
+            usize target_i = channels * (target_y * width + target_x);
+            i16 new_r = (i16)data[target_i + 0] +
+                (i16)((double)quant_err[0] * algorithm.ptr[j].factor);
+            i16 new_g = (i16)data[target_i + 1] +
+                (i16)((double)quant_err[1] * algorithm.ptr[j].factor);
+            i16 new_b = (i16)data[target_i + 2] +
+                (i16)((double)quant_err[2] * algorithm.ptr[j].factor);
+
+            clamp(new_r, 0, 255);
+            clamp(new_g, 0, 255);
+            clamp(new_b, 0, 255);
+
+            data[target_i + 0] = (u8)new_r;
+            data[target_i + 1] = (u8)new_g;
+            data[target_i + 2] = (u8)new_b;
+        }
+    }
+}
+
+static void image_quantise_search(
+    u8 *data,
+    usize width,
+    usize height,
+    const Search *search,
+    Dither_Algorithm algorithm,
+    u8 *memo
+) {
+    image_quantise_strip(
+        data, width, height, height, search, algorithm, memo
+    );
+}
+
+// Distinct colours of an image quantised without dithering, and the palette
+// index of each. Flat artwork and screenshots have a few thousand at most;
+// photographs reach the limit within their first rows.
+#define image_unique_bits 14
+#define image_unique_slots ((usize)1 << image_unique_bits)
+#define image_unique_max (image_unique_slots / 2)
+
+typedef struct Image_Unique {
+    // The colour with bit 24 set, or zero for an empty slot.
+    u32 keys[image_unique_slots];
+    u8 indices[image_unique_slots];
+} Image_Unique;
+
+// Searches once for each distinct colour and copies the result to the rest,
+// which makes the cost per pixel independent of the palette size. Stops once
+// there are too many distinct colours to be worth it, and returns the number
+// of pixels quantised by then. Palettes of up to search_palette_max colours.
+static usize image_quantise_unique(
+    u8 *data,
+    usize pixels_len,
+    const Search *search
+) {
+    Image_Unique *unique = calloc(1, sizeof(Image_Unique));
+    if (unique == NULL) return 0;
+    Palette palette = search->palette;
+    usize unique_len = 0;
+    usize i = 0;
+    for (; i < pixels_len; i += 1) {
+        u8 *pixel = data + 3 * i;
+        u32 key = (u32)1 << 24 | (u32)pixel[0] << 16 | (u32)pixel[1] << 8 |
+            pixel[2];
+        usize slot = (key * 2654435761u) >> (32 - image_unique_bits);
+        while (unique->keys[slot] != 0 && unique->keys[slot] != key) {
+            slot = (slot + 1) & (image_unique_slots - 1);
+        }
+        if (unique->keys[slot] == 0) {
+            if (unique_len == image_unique_max) break;
+            unique_len += 1;
+            unique->keys[slot] = key;
+            unique->indices[slot] = (u8)search_nearest(search, pixel);
+        }
+        Rgb colour = palette.ptr[unique->indices[slot]];
+        pixel[0] = colour.r;
+        pixel[1] = colour.g;
+        pixel[2] = colour.b;
+    }
+    free(unique);
+    return i;
+}
+
+// Whether every pixel is already a palette colour, in which case quantising
+// changes nothing whatever the dithering: each pixel is its own nearest colour
+// and leaves no error to diffuse. Looks colours up in a hash set of the
+// palette, skipping runs of the same colour, and stops at the first pixel
+// that is not in it. `channels` is 3 for rgb or 1 for grey.
+#define image_conforms_bits 10
+
+static maybe_unused bool image_conforms(
+    const u8 *data,
+    usize pixels_len,
+    int channels,
+    Palette palette
+) {
+    if (palette.len > search_palette_max) return false;
+    // Colours with bit 24 set, or zero for an empty slot.
+    u32 keys[(usize)1 << image_conforms_bits] = { 0 };
+    usize mask = ((usize)1 << image_conforms_bits) - 1;
+    for (usize j = 0; j < palette.len; j += 1) {
+        Rgb c = palette.ptr[j];
+        u32 key = (u32)1 << 24 | (u32)c.r << 16 | (u32)c.g << 8 | c.b;
+        usize slot = (key * 2654435761u) >> (32 - image_conforms_bits);
+        while (keys[slot] != 0 && keys[slot] != key) slot = (slot + 1) & mask;
+        keys[slot] = key;
+    }
+
+    u32 prev_key = 0;
+    for (usize i = 0; i < pixels_len; i += 1) {
+        const u8 *pixel = data + i * channels;
+        u32 key = channels == 1 ? (u32)1 << 24 | (u32)pixel[0] * 0x010101u :
+            (u32)1 << 24 | (u32)pixel[0] << 16 | (u32)pixel[1] << 8 | pixel[2];
+        if (key == prev_key) continue;
+        usize slot = (key * 2654435761u) >> (32 - image_conforms_bits);
+        while (keys[slot] != 0 && keys[slot] != key) slot = (slot + 1) & mask;
+        if (keys[slot] == 0) return false;
+        prev_key = key;
+    }
+    return true;
+}
+
+// Quantises with the search that the dispatch table picks for the palette.
+// Without dithering or a `memo` from the caller, each distinct colour is
+// searched for once where there are few enough of them; otherwise SEARCH_LUT
+// makes a memo for this image.
+static void image_quantise_memo(
+    u8 *data,
+    usize width,
+    usize height,
+    Palette palette,
+    Dither_Algorithm algorithm,
+    u8 *memo
+) {
+    Search search;
+    search_init(&search, palette, search_kind_for(palette.len));
+    if (memo == NULL && algorithm.len == 0 &&
+        palette.len <= search_palette_max
+    ) {
+        usize pixels_len = width * height;
+        usize done = image_quantise_unique(data, pixels_len, &search);
+        if (done == pixels_len) return;
+        // The rest, as a single row, which is the same without dithering.
+        data += done * 3;
+        width = pixels_len - done;
+        height = 1;
+    }
+    u8 *image_memo = NULL;
+    if (memo == NULL && search.kind == SEARCH_LUT &&
+        palette.len <= image_memo_palette_max
+    ) {
+        // Falls back to searching every pixel when this fails.
+        memo = image_memo = calloc(image_memo_len, 1);
+    }
+    image_quantise_search(data, width, height, &search, algorithm, memo);
+    free(image_memo);
+}
+
+// The quantiser as it was before any of the faster paths: every pixel is
+// compared with every palette colour, and error is diffused across the whole
+// image. Kept apart from image_quantise_strip and search.c, so that a change to
+// either is caught by --verify and src/test.c rather than copied into the
+// reference. Do not optimise.
+static maybe_unused void image_quantise_reference(
+    u8 *data,
+    usize width,
+    usize height,
+    Palette palette,
+    Dither_Algorithm algorithm
+) {
+    const usize channels = 3;
+    usize data_len = width * height * channels;
+    for (usize i = 0; i < data_len; i += channels) {
+        u16 min_diff = 999;
+        usize best_match = 0;
+        for (usize j = 0; j < palette.len; j += 1) {
+            u16 diff_total = (u16)abs(data[i + 0] - palette.ptr[j].r) +
+                             (u16)abs(data[i + 1] - palette.ptr[j].g) +
+                             (u16)abs(data[i + 2] - palette.ptr[j].b);
+            if (diff_total < min_diff) {
+                min_diff = diff_total;
+                best_match = j;
+            }
+        }
+
+        i16 quant_err[3] = {
+            (i16)data[i + 0] - palette.ptr[best_match].r,
+            (i16)data[i + 1] - palette.ptr[best_match].g,
+            (i16)data[i + 2] - palette.ptr[best_match].b
+        };
+
+        data[i + 0] = palette.ptr[best_match].r;
+        data[i + 1] = palette.ptr[best_match].g;
+        data[i + 2] = palette.ptr[best_match].b;
+
+        usize current_x = (i / channels) % width;
+        usize current_y = (i / channels) / width;
+        for (usize j = 0; j < algorithm.len; j++) {
+            i64 target_x = current_x + algorithm.ptr[j].x_offset;
+            i64 target_y = current_y + algorithm.ptr[j].y_offset;
+            if (target_x < 0 || target_x >= (i64)width ||
+                target_y < 0 || target_y >= (i64)height
+            ) {
+                continue;
+            }
+
+            usize target_i = channels * (target_y * width + target_x);
+            i16 new_r = (i16)data[target_i + 0] +
+                (i16)((double)quant_err[0] * algorithm.ptr[j].factor);
+            i16 new_g = (i16)data[target_i + 1] +
+                (i16)((double)quant_err[1] * algorithm.ptr[j].factor);
+            i16 new_b = (i16)data[target_i + 2] +
+                (i16)((double)quant_err[2] * algorithm.ptr[j].factor);
+
+            clamp(new_r, 0, 255);
+            clamp(new_g, 0, 255);
+            clamp(new_b, 0, 255);
+
+            data[target_i + 0] = (u8)new_r;
+            data[target_i + 1] = (u8)new_g;
+            data[target_i + 2] = (u8)new_b;
+        }
+    }
+}
+
+// Compares a quantised frame with the reference's, reporting the number of
+// differing pixels and the first of them.
+static maybe_unused error image_verify(
+    const u8 *data,
+    const u8 *reference,
+    usize width,
+    usize height,
+    Str8 path,
+    usize frame_i
+) {
+    usize pixels_len = width * height;
+    usize diffs_len = 0, first = 0;
+    for (usize i = 0; i < pixels_len; i += 1) {
+        if (memcmp(data + 3 * i, reference + 3 * i, 3) == 0) continue;
+        if (diffs_len == 0) first = i;
+        diffs_len += 1;
+    }
+    if (diffs_len == 0) return 0;
+    const u8 *got = data + 3 * first, *expected = reference + 3 * first;
+    return errf(
+        "verify failed for '%.*s', frame %zu: %zu of %zu pixels differ from "
+            "the reference quantiser; first at (%zu, %zu), "
+            "%02x%02x%02x instead of %02x%02x%02x",
+        str8_fmt(path), frame_i, diffs_len, pixels_len,
+        first % width, first / width,
+        got[0], got[1], got[2], expected[0], expected[1], expected[2]
+    );
+}
+
+// The previous frame of a sequence, before and after quantising without
+// dithering. Each output pixel then depends only on the same input pixel, so
+// blocks that are unchanged since the previous frame can be copied from its
+// output instead of being quantised again.
+typedef struct Image_Frame_Cache {
+    u8 *source;
+    u8 *output;
+    bool valid;
+} Image_Frame_Cache;
+
+#define image_block_size 16
+
+static void image_frame_cache_deinit(Image_Frame_Cache *cache) {
+    free(cache->source);
+    free(cache->output);
+}
+
+static maybe_unused error image_frame_cache_init(
+    Image_Frame_Cache *cache,
+    usize data_len
+) {
+    *cache = (Image_Frame_Cache){
+        .source = malloc(data_len),
+        .output = malloc(data_len),
+    };
+    if (cache->source == NULL || cache->output == NULL) {
+        image_frame_cache_deinit(cache);
+        *cache = (Image_Frame_Cache){ 0 };
+        return err("allocation failure");
+    }
+    return 0;
+}
+
+static maybe_unused void image_quantise_cached(
+    u8 *data,
+    usize width,
+    usize height,
+    Palette palette,
+    u8 *memo,
+    Image_Frame_Cache *cache
+) {
+    usize stride = width * 3;
+    Search search;
+    search_init(&search, palette, search_kind_for(palette.len));
+    for (usize block_y = 0; block_y < height; block_y += image_block_size) {
+        usize rows = height - block_y;
+        if (rows > image_block_size) rows = image_block_size;
+
+        for (usize block_x = 0; block_x < width; block_x += image_block_size) {
+            usize cols = width - block_x;
+            if (cols > image_block_size) cols = image_block_size;
+            usize offset = block_y * stride + block_x * 3;
+            usize segment_len = cols * 3;
+
+            bool changed = !cache->valid;
+            for (usize y = 0; y < rows && !changed; y += 1) {
+                usize i = offset + y * stride;
+                changed = memcmp(data + i, cache->source + i, segment_len) != 0;
+            }
+
+            for (usize y = 0; y < rows; y += 1) {
+                usize i = offset + y * stride;
+                if (!changed) {
+                    memcpy(data + i, cache->output + i, segment_len);
+                    continue;
+                }
+                memcpy(cache->source + i, data + i, segment_len);
+                image_quantise_search(data + i, cols, 1, &search, none, memo);
+                memcpy(cache->output + i, data + i, segment_len);
+            }
+        }
+    }
+    cache->valid = true;
+}
+
+static void image_quantise(
+    u8 *data,
+    usize width,
+    usize height,
+    Palette palette,
+    Dither_Algorithm algorithm
+) {
+    image_quantise_memo(data, width, height, palette, algorithm, NULL);
+}
+
+// Grey images quantised to grey palettes keep one channel throughout, which
+// gives the same pixels as quantising them as rgb: the rgb path starts every
+// channel equal and carries the same error on each, so they stay equal.
+
+// image_invert on grey pixels.
+static maybe_unused void image_invert_grey(u8 *data, usize data_len) {
+    for (usize i = 0; i < data_len; i += 1) data[i] = 255 - data[i];
+}
+
+static maybe_unused void image_rgb_from_grey(
+    const u8 *grey,
+    usize pixels_len,
+    u8 *out
+) {
+    for (usize i = 0; i < pixels_len; i += 1) {
+        memset(out + 3 * i, grey[i], 3);
+    }
+}
+
+static maybe_unused void image_quantise_grey(
+    u8 *data,
+    usize width,
+    usize height,
+    Palette palette,
+    Dither_Algorithm algorithm
+) {
+    // Nearest palette grey for every grey, found with the rgb search so
+    // that ties resolve the same way.
+    Search search;
+    search_init(&search, palette, search_kind_for(palette.len));
+    u8 nearest[256];
+    for (usize v = 0; v < 256; v += 1) {
+        u8 rgb[3] = { (u8)v, (u8)v, (u8)v };
+        nearest[v] = palette.ptr[search_nearest(&search, rgb)].r;
+    }
+
+    usize data_len = width * height;
+    for (usize i = 0; i < data_len; i += 1) {
+        i16 quant_err = (i16)data[i] - nearest[data[i]];
+        data[i] = nearest[data[i]];
+
+        usize current_x = i % width;
+        usize current_y = i / width;
+        for (usize j = 0; j < algorithm.len; j++) {
+            i64 target_x = current_x + algorithm.ptr[j].x_offset;
+            i64 target_y = current_y + algorithm.ptr[j].y_offset;
+            if (target_x < 0 || target_x >= (i64)width ||
+                target_y < 0 || target_y >= (i64)height
+            ) {
+                continue;
+            }
+
+            usize target_i = target_y * width + target_x;
+            i16 new_v = (i16)data[target_i] +
+                (i16)((double)quant_err * algorithm.ptr[j].factor);
+            clamp(new_v, 0, 255);
+            data[target_i] = (u8)new_v;
+        }
+    }
+}
+
+static void image_write_func(void *file, void *data, int size) {
+    fwrite(data, 1, size, file);
+}
+
+// Frames following the first in `data`, and what GIF output needs to play
+// them back. Other formats only keep the first frame.
+typedef struct Image_Animation {
+    usize frames_len;
+    // Milliseconds per frame.
+    const int *delays;
+    // Non-zero for transparent pixels, across all frames. May be NULL.
+    const u8 *alpha;
+} Image_Animation;
+
+// `palette` is the one `data` was quantised to, if known. Two colours are
+// written at one bit per pixel where the format allows.
+static error image_encode_bilevel(
+    stbi_write_func *func,
+    void *func_ctx,
+    Format format,
+    const u8 *data,
+    int width,
+    int height,
+    int channels,
+    Palette palette
+) {
+    switch (format) {
+        case FORMAT_PNG: return bilevel_encode_png(
+            func, func_ctx, data, width, height, channels, palette
+        );
+        case FORMAT_BMP: return bilevel_encode_bmp(
+            func, func_ctx, data, width, height, channels, palette
+        );
+        default: return bilevel_encode_pbm(
+            func, func_ctx, data, width, height, channels, palette
+        );
+    }
+}
+
+static error image_encode_animation(
+    stbi_write_func *func,
+    void *func_ctx,
+    Format format,
+    const u8 *data,
+    int width,
+    int height,
+    int channels,
+    Palette palette,
+    const Image_Animation *animation
+) {
+    if (format == FORMAT_PBM || (palette.len == 2 &&
+        (format == FORMAT_PNG || format == FORMAT_BMP)
+    )) {
+        return image_encode_bilevel(
+            func, func_ctx, format, data, width, height, channels, palette
+        );
+    }
+    bool write_ok = false;
+    switch (format) {
+        case FORMAT_JPG: {
+            write_ok = stbi_write_jpg_to_func(
+                func,
+                func_ctx,
+                width,
+                height,
+                channels,
+                data,
+                100
+            );
+        } break;
+        case FORMAT_PNG: {
+            int stride_in_bytes = width * channels;
+            write_ok = stbi_write_png_to_func(
+                func,
+                func_ctx,
+                width,
+                height,
+                channels,
+                data,
+                stride_in_bytes
+            );
+        } break;
+        case FORMAT_BMP: {
+            write_ok = stbi_write_bmp_to_func(
+                func,
+                func_ctx,
+                width,
+                height,
+                channels,
+                data
+            );
+        } break;
+        case FORMAT_GIF: {
+            if (channels != 3) return err("GIF output must be rgb");
+            if (animation == NULL) return gif_encode(
+                func, func_ctx, data, width, height, 1, NULL, NULL
+            );
+            return gif_encode(
+                func,
+                func_ctx,
+                data,
+                width,
+                height,
+                animation->frames_len,
+                animation->delays,
+                animation->alpha
+            );
+        } break;
+        default: break;
+    }
+
+    if (!write_ok) return err("error encoding image");
+    return 0;
+}
+
+static error image_encode(
+    stbi_write_func *func,
+    void *func_ctx,
+    Format format,
+    const u8 *data,
+    int width,
+    int height
+) {
+    return image_encode_animation(
+        func, func_ctx, format, data, width, height, 3, (Palette){ 0 }, NULL
+    );
+}
+
+// `channels` is 3 for rgb or 1 for grey.
+static maybe_unused error image_write(
+    FILE *file,
+    Format format,
+    const u8 *data,
+    int width,
+    int height,
+    int channels,
+    Palette palette,
+    const Image_Animation *animation
+) {
+    try (image_encode_animation(
+        image_write_func, file, format, data, width, height, channels,
+        palette, animation
+    ));
+    if (ferror(file)) return err("error encoding image");
+    return 0;
+}
+
+// Growable heap buffer for encoding to memory.
+typedef struct Image_Buffer {
+    u8 *ptr;
+    usize len;
+    usize cap;
+    bool failed;
+} Image_Buffer;
+
+static void image_buffer_write_func(void *ctx, void *data, int size) {
+    Image_Buffer *buf = ctx;
+    if (buf->failed) return;
+    if (buf->len + size > buf->cap) {
+        usize new_cap = buf->cap == 0 ? 64 * 1024 : buf->cap;
+        while (buf->len + size > new_cap) new_cap *= 2;
+        u8 *new_ptr = realloc(buf->ptr, new_cap);
+        if (new_ptr == NULL) {
+            buf->failed = true;
+            return;
+        }
+        buf->ptr = new_ptr;
+        buf->cap = new_cap;
+    }
+    memcpy(buf->ptr + buf->len, data, size);
+    buf->len += size;
+}
+
+static error image_write_buffer(
+    Image_Buffer *buf,
+    Format format,
+    const u8 *data,
+    int width,
+    int height,
+    int channels,
+    Palette palette,
+    const Image_Animation *animation
+) {
+    try (image_encode_animation(
+        image_buffer_write_func, buf, format, data, width, height, channels,
+        palette, animation
+    ));
+    if (buf->failed) return err("allocation failure");
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Library build of imgclr; see imgclr.h. The command-line tool includes this
+// file too, so both share one implementation.
+
+#include "base.c"
+#include "imgclr.h"
+
+#include "colour.c"
+#include "thread.c"
+#include "palette.c"
+#include "dither.c"
+#include "search.c"
+
+#ifndef DEBUG
+    // Keep stb's symbols private, so that embedding programs may link their
+    // own copy of stb_image.
+    #define STB_IMAGE_STATIC
+    #define STB_IMAGE_WRITE_STATIC
+    #include "stbi.c"
+#else
+    #include "stb_image.h"
+    #include "stb_image_write.h"
+#endif // DEBUG
+
+#include "gif.c"
+#include "bilevel.c"
+#include "image.c"
+
+#if defined(_WIN32) && defined(IMGCLR_SHARED)
+    #define IMGCLR_API __declspec(dllexport)
+#elif defined(__GNUC__)
+    #define IMGCLR_API __attribute__((visibility("default")))
+#else
+    #define IMGCLR_API
+#endif
+
+typedef char imgclr_rgb_matches_internal_layout[
+    sizeof(Imgclr_Rgb) == sizeof(Rgb) ? 1 : -1
+];
+
+static error dither_algorithm_from_imgclr(
+    Imgclr_Dither dither,
+    Dither_Algorithm *out
+) {
+    switch (dither) {
+        case IMGCLR_DITHER_FLOYD_STEINBERG: *out = floyd_steinberg; break;
+        case IMGCLR_DITHER_NONE: *out = none; break;
+        case IMGCLR_DITHER_ATKINSON: *out = atkinson; break;
+        case IMGCLR_DITHER_JJN: *out = jjn; break;
+        case IMGCLR_DITHER_BURKES: *out = burkes; break;
+        case IMGCLR_DITHER_SIERRA_LITE: *out = sierra_lite; break;
+        default: return errf("invalid algorithm %d", (int)dither);
+    }
+    return 0;
+}
+
+static error format_from_imgclr(Imgclr_Format format, Format *out) {
+    switch (format) {
+        case IMGCLR_FORMAT_JPG: *out = FORMAT_JPG; break;
+        case IMGCLR_FORMAT_PNG: *out = FORMAT_PNG; break;
+        case IMGCLR_FORMAT_BMP: *out = FORMAT_BMP; break;
+        case IMGCLR_FORMAT_GIF: *out = FORMAT_GIF; break;
+        default: return errf("invalid format %d", (int)format);
+    }
+    return 0;
+}
+
+IMGCLR_API int imgclr_quantize(
+    const unsigned char *rgb,
+    int width,
+    int height,
+    int stride,
+    const Imgclr_Rgb *palette,
+    size_t palette_len,
+    Imgclr_Dither algorithm,
+    unsigned flags,
+    unsigned char *out
+) {
+    if (width <= 0 || height <= 0) return err("invalid image dimensions");
+    if (palette_len < 2) {
+        return err("expected at least two (2) palette colours");
+    }
+    usize row_len = (usize)width * 3;
+    usize in_stride = stride == 0 ? row_len : (usize)stride;
+    if (in_stride < row_len) return err("stride is smaller than a row");
+
+    Dither_Algorithm dither = { 0 };
+    try (dither_algorithm_from_imgclr(algorithm, &dither));
+
+    // The quantiser works in place, so the only pass over the input is the
+    // one that lays it out in `out`.
+    if (out != rgb || in_stride != row_len) {
+        for (usize y = 0; y < (usize)height; y += 1) {
+            memmove(out + y * row_len, rgb + y * in_stride, row_len);
+        }
+    }
+
+    usize data_len = row_len * (usize)height;
+    if (flags & IMGCLR_INVERT) image_invert(out, data_len);
+    Palette pal = { .ptr = (Rgb *)palette, .len = palette_len };
+    image_quantise(out, (usize)width, (usize)height, pal, dither);
+    return 0;
+}
+
+IMGCLR_API unsigned char *imgclr_decode(
+    const unsigned char *data,
+    size_t data_len,
+    int *width,
+    int *height
+) {
+    if (data_len > INT_MAX) {
+        err("image is too large");
+        return NULL;
+    }
+    int channels = 0;
+    u8 *pixels = stbi_load_from_memory(
+        data, (int)data_len, width, height, &channels, 3
+    );
+    if (pixels == NULL) {
+        errf("error loading image:\n%s", stbi_failure_reason());
+    }
+    return pixels;
+}
+
+IMGCLR_API int imgclr_encode_to_func(
+    const unsigned char *rgb,
+    int width,
+    int height,
+    Imgclr_Format format,
+    Imgclr_Write_Fn *write,
+    void *ctx
+) {
+    Format internal_format = FORMAT_PNG;
+    try (format_from_imgclr(format, &internal_format));
+    return image_encode(write, ctx, internal_format, rgb, width, height);
+}
+
+IMGCLR_API int imgclr_encode(
+    const unsigned char *rgb,
+    int width,
+    int height,
+    Imgclr_Format format,
+    unsigned char **out,
+    size_t *out_len
+) {
+    Format internal_format = FORMAT_PNG;
+    try (format_from_imgclr(format, &internal_format));
+    Image_Buffer buf = { 0 };
+    if (image_write_buffer(
+        &buf, internal_format, rgb, width, height, 3, (Palette){ 0 }, NULL
+    ) != 0) {
+        free(buf.ptr);
+        return 1;
+    }
+    *out = buf.ptr;
+    *out_len = buf.len;
+    return 0;
+}
+
+IMGCLR_API void imgclr_free(void *ptr) {
+    // Decoded images come from stb_image, which allocates with malloc.
+    free(ptr);
+}
@@ -0,0 +1,99 @@
+// libimgclr - the imgclr quantiser as an embeddable library.
+//
+// Build `src/imgclr.c` as a single translation unit, either directly into
+// your program or as a static/shared library, and include this header.
+// Functions return 0 on success and non-zero on failure; failures are
+// described on stderr.
+
+#ifndef IMGCLR_H
+#define IMGCLR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct { unsigned char r, g, b; } Imgclr_Rgb;
+
+typedef enum {
+    IMGCLR_DITHER_FLOYD_STEINBERG = 0,
+    IMGCLR_DITHER_NONE,
+    IMGCLR_DITHER_ATKINSON,
+    IMGCLR_DITHER_JJN,
+    IMGCLR_DITHER_BURKES,
+    IMGCLR_DITHER_SIERRA_LITE,
+} Imgclr_Dither;
+
+typedef enum {
+    IMGCLR_FORMAT_JPG = 0,
+    IMGCLR_FORMAT_PNG,
+    IMGCLR_FORMAT_BMP,
+    // Limited to 256 distinct colours, which any quantised image with a
+    // palette of at most 256 colours satisfies.
+    IMGCLR_FORMAT_GIF,
+} Imgclr_Format;
+
+// Flags for imgclr_quantize.
+enum {
+    // Invert luminance, preserving hue and saturation, before quantising.
+    IMGCLR_INVERT = 1 << 0,
+};
+
+// Quantises a `width` x `height` RGB image to `palette`. Rows of `rgb` start
+// `stride` bytes apart; 0 means tightly packed (width * 3). The result is
+// written tightly packed to `out`, which may be `rgb` itself when the input is
+// tightly packed, in which case the image is processed in place.
+int imgclr_quantize(
+    const unsigned char *rgb,
+    int width,
+    int height,
+    int stride,
+    const Imgclr_Rgb *palette,
+    size_t palette_len,
+    Imgclr_Dither algorithm,
+    unsigned flags,
+    unsigned char *out
+);
+
+// Decodes a JPG, PNG, BMP, GIF or PNM image held in memory to tightly packed
+// RGB. Only the first frame of an animated GIF is decoded.
+// Free the returned pixels with imgclr_free.
+unsigned char *imgclr_decode(
+    const unsigned char *data,
+    size_t data_len,
+    int *width,
+    int *height
+);
+
+typedef void Imgclr_Write_Fn(void *ctx, void *data, int size);
+
+// Encodes tightly packed RGB, handing the output to `write` in chunks as it is
+// produced, so callers can stream it without an intermediate buffer.
+int imgclr_encode_to_func(
+    const unsigned char *rgb,
+    int width,
+    int height,
+    Imgclr_Format format,
+    Imgclr_Write_Fn *write,
+    void *ctx
+);
+
+// Encodes tightly packed RGB into a newly allocated buffer. Free `*out` with
+// imgclr_free.
+int imgclr_encode(
+    const unsigned char *rgb,
+    int width,
+    int height,
+    Imgclr_Format format,
+    unsigned char **out,
+    size_t *out_len
+);
+
+void imgclr_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IMGCLR_H
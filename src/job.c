@@ -0,0 +1,976 @@
+// One input/output pair moving through the decode -> quantise -> encode
+// pipeline. In a batch, each stage runs as its own pool task, so the stages of
+// different images overlap across workers.
+
+typedef struct {
+    // Used when `palette_spec` is PALETTE_GIVEN; otherwise each image gets its
+    // own palette generated from its pixels.
+    Palette palette;
+    Palette_Spec palette_spec;
+    Dither_Algorithm algorithm;
+    bool invert;
+} Job_Options;
+
+// Either hex colours or a single palette spec such as `auto:16`.
+static error job_palette_from_strs(
+    Arena *arena,
+    char **strs,
+    usize strs_len,
+    Job_Options *out
+) {
+    out->palette = (Palette){ 0 };
+    out->palette_spec = (Palette_Spec){ .method = PALETTE_GIVEN };
+    if (strs_len == 1) {
+        bool is_spec = false;
+        try (palette_spec_from_str8(
+            str8_from_cstr(strs[0]), &out->palette_spec, &is_spec
+        ));
+        if (is_spec) return 0;
+    }
+    return palette_from_hex_strs(arena, strs, strs_len, &out->palette);
+}
+
+static error job_options_from_flags(
+    Arena *arena,
+    char **argv,
+    Args_Flag *palette_flag,
+    Args_Flag *dither_flag,
+    Args_Flag *invert_flag,
+    Job_Options *out
+) {
+    if (!palette_flag->is_present) {
+        return err("expected at least two (2) palette colours");
+    }
+    try (job_palette_from_strs(
+        arena,
+        argv + palette_flag->multi_pos.beg_i,
+        palette_flag->multi_pos.end_i - palette_flag->multi_pos.beg_i,
+        out
+    ));
+
+    out->algorithm = floyd_steinberg;
+    if (dither_flag->is_present) try (
+        dither_algorithm_from_str8(dither_flag->single_pos, &out->algorithm)
+    );
+    out->invert = invert_flag->is_present;
+    return 0;
+}
+
+typedef Slice(Job_Options) Job_Variants;
+
+// Every combination of the given palettes (groups of colours separated by
+// '/') and dither algorithms, palette-major. A `reference` palette, if not
+// NULL, stands in for the palette flag.
+static error job_variants_from_flags(
+    Arena *arena,
+    char **argv,
+    Args_Flag *palette_flag,
+    const Palette *reference,
+    Args_Flag *dither_flag,
+    Args_Flag *invert_flag,
+    Job_Variants *out
+) {
+    if (!palette_flag->is_present && reference == NULL) {
+        return err("expected at least two (2) palette colours");
+    }
+    // An empty range yields a single group, which takes the reference.
+    int palette_beg_i = reference != NULL ? 0 : palette_flag->multi_pos.beg_i;
+    int palette_end_i = reference != NULL ? 0 : palette_flag->multi_pos.end_i;
+    usize palettes_len = 1;
+    for (int i = palette_beg_i; i < palette_end_i; i += 1) {
+        if (strcmp(argv[i], "/") == 0) palettes_len += 1;
+    }
+    usize algorithms_len = !dither_flag->is_present ? 1 :
+        (usize)(dither_flag->multi_pos.end_i - dither_flag->multi_pos.beg_i);
+
+    out->len = palettes_len * algorithms_len;
+    try (arena_alloc(arena, out->len * sizeof(Job_Options), &out->ptr));
+
+    usize variant_i = 0;
+    for (int group_beg_i = palette_beg_i; group_beg_i <= palette_end_i;) {
+        int group_end_i = group_beg_i;
+        while (group_end_i < palette_end_i && 
+            strcmp(argv[group_end_i], "/") != 0
+        ) {
+            group_end_i += 1;
+        }
+        Job_Options group_options = { 0 };
+        if (reference != NULL) {
+            group_options.palette = *reference;
+        } else {
+            try (job_palette_from_strs(
+                arena, argv + group_beg_i, group_end_i - group_beg_i, 
+                &group_options
+            ));
+        }
+
+        for (usize i = 0; i < algorithms_len; i += 1) {
+            Job_Options *options = &out->ptr[variant_i];
+            variant_i += 1;
+            *options = (Job_Options){
+                .palette = group_options.palette,
+                .palette_spec = group_options.palette_spec,
+                .algorithm = floyd_steinberg,
+                .invert = invert_flag->is_present,
+            };
+            if (!dither_flag->is_present) continue;
+            Str8 algorithm = str8_from_cstr(
+                argv[dither_flag->multi_pos.beg_i + (int)i]
+            );
+            try (dither_algorithm_from_str8(algorithm, &options->algorithm));
+        }
+        group_beg_i = group_end_i + 1;
+    }
+    return 0;
+}
+
+typedef struct Batch {
+    bool serial;
+    Pool pool;
+    Budget budget;
+    Budget slots;
+    usize submitted;
+    usize failed;
+    // Optional; only consulted for outputs written to files.
+    Cache *cache;
+    // Threads a single job may start for palette generation, beyond the
+    // workers; only worthwhile when the workers have nothing else to do.
+    usize palette_threads_len;
+    // Optional; collects --stats.
+    Stats *stats;
+    // Checks every quantised frame against the reference quantiser.
+    bool verify;
+    // Copies inputs that need no quantising to their outputs as they are,
+    // where the formats match.
+    bool passthrough;
+} Batch;
+
+// Lets a thread outside the pool wait for a job it submitted to a batch.
+typedef struct Job_Done {
+    Mutex mutex;
+    Cond cond;
+    bool finished;
+    error e;
+} Job_Done;
+
+static void job_done_init(Job_Done *done) {
+    *done = (Job_Done){ 0 };
+    mutex_init(&done->mutex);
+    cond_init(&done->cond);
+}
+
+static void job_done_deinit(Job_Done *done) {
+    mutex_deinit(&done->mutex);
+    cond_deinit(&done->cond);
+}
+
+static error job_done_wait(Job_Done *done) {
+    mutex_lock(&done->mutex);
+    while (!done->finished) cond_wait(&done->cond, &done->mutex);
+    mutex_unlock(&done->mutex);
+    return done->e;
+}
+
+static void job_done_signal(Job_Done *done, error e) {
+    mutex_lock(&done->mutex);
+    done->finished = true;
+    done->e = e;
+    cond_signal(&done->cond);
+    mutex_unlock(&done->mutex);
+}
+
+typedef struct Job {
+    const Job_Options *options;
+    Batch *batch;
+    // Optional; signalled once the job is finished, after which it is no
+    // longer touched.
+    Job_Done *done;
+    // Optional; where the job's error messages go, on whichever thread runs
+    // it.
+    FILE *err_file;
+    // Paths as shown to the user. Without a `dir`, these are also the paths
+    // that get opened; with one, the names are opened relative to it.
+    Str8 infile_path;
+    Str8 outfile_path;
+    Format outfile_format;
+    Dir_Ref *dir;
+    Str8 infile_name;
+    Str8 outfile_name;
+    // Set for jobs allocated by a producer with malloc, freed once finished.
+    bool owned;
+    // In-memory output: when set, the encoded image is appended here instead
+    // of being written to `outfile_path`.
+    Image_Buffer *outfile_buffer;
+    // Suppresses the message printed for each written image.
+    bool quiet;
+    // Fan-out: the input is decoded once and each of `variants` quantises its
+    // own copy of the pixels. Such a job has no output of its own, and is
+    // finished by whichever variant finishes last.
+    struct Job *variants;
+    usize variants_len;
+    struct Job *source;
+    usize refs;
+    // Animated input. Frames follow each other in `data` and, in a batch, are
+    // quantised as separate tasks.
+    usize frames_len;
+    int *delays;
+    u8 *alpha;
+    struct Job_Frame *frame_tasks;
+    usize frames_left;
+    // The palette in use: the options' own, or one generated for this image.
+    Palette palette;
+    Rgb *generated_palette;
+    // Set once every frame is inverted, ahead of generating the palette.
+    bool inverted;
+    // Hash of the encoded input, and whether the output was served from the
+    // batch's cache instead of being processed.
+    u64 input_hash;
+    bool cached;
+    // Set when a frame differs from the reference quantiser under --verify.
+    // The output is still written, but the job fails.
+    bool verify_failed;
+    // Set when the encoded input is written as the output, which keeps it
+    // until then.
+    bool passthrough;
+
+    Arena arena;
+    // Encoded input. May be filled by the caller, in which case the input is
+    // never read from disk and the memory stays owned by the caller.
+    Str8 infile;
+    u8 *data;
+    int width;
+    int height;
+    // 3 for rgb, or 1 for grey inputs quantised to grey palettes.
+    int channels;
+    // Taken from the batch's memory budget from decoding until finished.
+    usize budget_bytes;
+    Budget_Waiter budget_waiter;
+} Job;
+
+static Stats *job_stats(Job *job) {
+    return job->batch != NULL ? job->batch->stats : NULL;
+}
+
+static Stats_Mark job_mark(Job *job) {
+    return stats_begin(job_stats(job), job->infile_path, job->outfile_path);
+}
+
+static void job_arena_deinit(Job *job) {
+    if (job->arena.mem != NULL) {
+        stats_arena_release(job_stats(job), job->arena.cap);
+    }
+    arena_deinit(&job->arena);
+}
+
+static Str8 job_outfile_name(Job *job) {
+    return job->dir != NULL ? job->outfile_name : job->outfile_path;
+}
+
+static error job_open(Job *job, bool write, FILE **out) {
+    if (write) cache_detach(job->dir, (char *)job_outfile_name(job).ptr);
+    Str8 path = write ? job->outfile_path : job->infile_path;
+    if (job->dir == NULL) return file_open(path, write ? "wb" : "rb", out);
+    Str8 name = write ? job->outfile_name : job->infile_name;
+    return dir_open_file(job->dir, name, write, path, out);
+}
+
+static error job_read(Job *job) {
+    Stats_Mark mark = job_mark(job);
+    FILE *file = NULL; try (job_open(job, false, &file));
+    usize infile_len = 0;
+    error e = file_len(file, &infile_len);
+    if (e == 0) e = arena_init(
+        &job->arena, infile_len + 2 * ARENA_DEFAULT_ALIGNMENT
+    );
+    if (e == 0) e = file_read_from(&job->arena, file, &job->infile);
+    fclose(file);
+    if (job->arena.mem != NULL) {
+        stats_arena_acquire(job_stats(job), job->arena.cap);
+    }
+    if (e != 0) return errf(
+        "error reading '%.*s'", str8_fmt(job->infile_path)
+    );
+    stats_add(job_stats(job), STATS_READ, mark, 0, job->infile.len);
+    return 0;
+}
+
+static bool job_outputs_animation(Job *job) {
+    if (job->variants_len == 0) return job->outfile_format == FORMAT_GIF;
+    for (usize i = 0; i < job->variants_len; i += 1) {
+        Job *variant = &job->variants[i];
+        if (!variant->cached && variant->outfile_format == FORMAT_GIF) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static error job_decode_gif(Job *job) {
+    int frames_len = 0, channels = 0;
+    job->data = stbi_load_gif_from_memory(
+        job->infile.ptr,
+        (int)job->infile.len,
+        &job->delays,
+        &job->width,
+        &job->height,
+        &frames_len,
+        &channels,
+        4
+    );
+    if (job->data == NULL) return errf(
+        "error loading '%.*s':\n%s",
+        str8_fmt(job->infile_path), stbi_failure_reason()
+    );
+
+    // Only GIF output can carry the other frames.
+    job->frames_len = job_outputs_animation(job) ? (usize)frames_len : 1;
+    usize pixels_len = (usize)job->width * (usize)job->height * job->frames_len;
+    if (image_rgb_from_rgba(job->data, pixels_len, &job->alpha) != 0) {
+        return errf("error loading '%.*s'", str8_fmt(job->infile_path));
+    }
+    return 0;
+}
+
+// Covers everything that determines the output bytes.
+static u64 job_cache_key(Job *job) {
+    const Job_Options *options = job->options;
+    u64 key = hash64(
+        options->palette.ptr,
+        options->palette.len * sizeof(Rgb),
+        job->input_hash
+    );
+    u64 palette_spec[3] = {
+        options->palette_spec.method,
+        options->palette_spec.colours_len,
+        options->palette_spec.row_stride,
+    };
+    key = hash64(palette_spec, sizeof(palette_spec), key);
+    key = hash64(
+        options->algorithm.ptr,
+        options->algorithm.len * sizeof(Dither_Error),
+        key
+    );
+    u8 flags[2] = { options->invert, (u8)job->outfile_format };
+    key = hash64(flags, sizeof(flags), key);
+    // Copied inputs differ from encoded outputs byte for byte.
+    if (job->batch->passthrough) key = hash64("passthrough", 11, key);
+    return key;
+}
+
+static bool job_cache_fetch(Job *job) {
+    Cache *cache = job->batch->cache;
+    job->cached = cache_fetch(
+        cache,
+        job_cache_key(job),
+        job->outfile_format,
+        job->dir,
+        (char *)job_outfile_name(job).ptr
+    );
+    if (job->cached && !job->quiet) printf(
+        "copied cached image to '%.*s'\n", str8_fmt(job->outfile_path)
+    );
+    return job->cached;
+}
+
+// Serves outputs from the cache where possible. Returns true when none are
+// left to process, so the input need not be decoded.
+static bool job_cache_serve(Job *job) {
+    if (job->batch == NULL || job->batch->cache == NULL) return false;
+    if (job->outfile_buffer != NULL) return false;
+
+    job->input_hash = hash64(
+        job->infile.ptr, job->infile.len, job->batch->cache->seed
+    );
+    if (job->variants_len == 0) return job_cache_fetch(job);
+
+    bool all_cached = true;
+    for (usize i = 0; i < job->variants_len; i += 1) {
+        Job *variant = &job->variants[i];
+        variant->batch = job->batch;
+        variant->input_hash = job->input_hash;
+        if (!job_cache_fetch(variant)) all_cached = false;
+    }
+    job->cached = all_cached;
+    return all_cached;
+}
+
+// Grey inputs keep a single channel when every output quantises to a given
+// grey palette and none is a GIF, which needs rgb.
+static bool job_wants_grey(Job *job) {
+    usize outputs_len = job->variants_len == 0 ? 1 : job->variants_len;
+    Job *outputs = job->variants_len == 0 ? job : job->variants;
+    for (usize i = 0; i < outputs_len; i += 1) {
+        Job *output = &outputs[i];
+        if (output->cached) continue;
+        if (output->options->palette_spec.method != PALETTE_GIVEN ||
+            !palette_is_grey(output->options->palette) ||
+            output->outfile_format == FORMAT_GIF
+        ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether the input can be written as the output under --passthrough: it is
+// the only output, in the input's own format, and every pixel is already a
+// colour of the given palette. Inputs with alpha or 16 bits per channel
+// would come out differently when encoded, unless as GIFs.
+static bool job_passes_through(Job *job, int channels) {
+    if (job->batch == NULL || !job->batch->passthrough) return false;
+    if (job->variants_len != 0 || job->outfile_buffer != NULL) return false;
+    const Job_Options *options = job->options;
+    if (options->palette_spec.method != PALETTE_GIVEN || options->invert) {
+        return false;
+    }
+    Format format;
+    if (!format_from_magic(job->infile, &format) ||
+        format != job->outfile_format
+    ) {
+        return false;
+    }
+    if (format != FORMAT_GIF && (channels == 2 || channels == 4 ||
+        stbi_is_16_bit_from_memory(job->infile.ptr, (int)job->infile.len)
+    )) {
+        return false;
+    }
+    usize pixels_len =
+        (usize)job->width * (usize)job->height * job->frames_len;
+    return image_conforms(
+        job->data, pixels_len, job->channels, options->palette
+    );
+}
+
+static bool job_is_gif(Job *job) {
+    return job->infile.len >= 4 && memcmp(job->infile.ptr, "GIF8", 4) == 0;
+}
+
+// Reads the input and serves what it can from the cache. For anything left to
+// decode, works out the bytes to take from the batch's memory budget first.
+static error job_prepare(Job *job) {
+    if (job->infile.ptr == NULL) try (job_read(job));
+    job->frames_len = 1;
+    if (job_cache_serve(job)) return 0;
+
+    int width = 0, height = 0, channels = 0;
+    bool is_gif = job_is_gif(job);
+    bool has_info = stbi_info_from_memory(
+        job->infile.ptr, (int)job->infile.len, &width, &height, &channels
+    );
+    // Grey with or without alpha.
+    job->channels =
+        !is_gif && has_info && channels <= 2 && job_wants_grey(job) ? 1 : 3;
+    if (job->batch != NULL) {
+        job->budget_bytes = job->arena.cap;
+        usize pixels = (usize)width * (usize)height;
+        if (has_info && is_gif) {
+            // Every frame is decoded, as rgba, and copied by each variant,
+            // however many of them are kept.
+            usize frames_len = gif_frames_len(job->infile);
+            if (frames_len == 0) frames_len = 1;
+            job->budget_bytes +=
+                frames_len * pixels * (4 + 3 * job->variants_len);
+        } else if (has_info) {
+            usize copies = 1 + job->variants_len;
+            job->budget_bytes += copies * pixels * job->channels;
+        }
+    }
+    return 0;
+}
+
+// Decodes the pixels, once job_prepare has run and the budget is taken.
+static error job_decode(Job *job) {
+    int channels = 0;
+    bool is_gif = job_is_gif(job);
+    Stats_Mark mark = job_mark(job);
+    if (is_gif) {
+        try (job_decode_gif(job));
+    } else {
+        job->data = stbi_load_from_memory(
+            job->infile.ptr,
+            (int)job->infile.len,
+            &job->width,
+            &job->height,
+            &channels,
+            job->channels
+        );
+        if (job->data == NULL) return errf(
+            "error loading '%.*s':\n%s",
+            str8_fmt(job->infile_path), stbi_failure_reason()
+        );
+    }
+
+    stats_add(
+        job_stats(job),
+        STATS_DECODE,
+        mark,
+        (u64)job->width * (u64)job->height * job->frames_len,
+        job->infile.len
+    );
+
+    // The encoded file is no longer needed once decoded, unless it is to be
+    // copied.
+    job->passthrough = job_passes_through(job, channels);
+    if (!job->passthrough) job_arena_deinit(job);
+    return 0;
+}
+
+// Gives a fan-out variant its own copy of the decoded pixels.
+static error job_copy_source(Job *job) {
+    if (job->source == NULL) return 0;
+    usize data_len =
+        (usize)job->width * (usize)job->height * job->channels *
+        job->frames_len;
+    job->data = malloc(data_len);
+    if (job->data == NULL) return err("allocation failure");
+    memcpy(job->data, job->source->data, data_len);
+    return 0;
+}
+
+// Picks the palette, generating it from the pixels if the options ask for it.
+// Must run before the pixels are quantised.
+static error job_palette(Job *job) {
+    const Job_Options *options = job->options;
+    job->palette = options->palette;
+    if (options->palette_spec.method == PALETTE_GIVEN) return 0;
+
+    job->generated_palette = malloc(palette_generated_max * sizeof(Rgb));
+    if (job->generated_palette == NULL) return err("allocation failure");
+    // Frames are stacked, so they read as one tall image.
+    usize rows = (usize)job->height * job->frames_len;
+    u64 pixels = (u64)job->width * rows;
+    Stats_Mark mark = job_mark(job);
+    // The palette is generated from the inverted image, as with --raw-rgb,
+    // so every frame is inverted here rather than as it is quantised.
+    if (options->invert) {
+        image_invert(job->data, (usize)pixels * 3);
+        job->inverted = true;
+        stats_add(job_stats(job), STATS_INVERT, mark, pixels, pixels * 3);
+        mark = job_mark(job);
+    }
+    usize threads_len =
+        job->batch != NULL ? job->batch->palette_threads_len : 1;
+    usize len = 0;
+    try (palette_generate(
+        &options->palette_spec, job->data, (usize)job->width, rows,
+        threads_len, job->generated_palette, &len
+    ));
+    stats_add(job_stats(job), STATS_PALETTE, mark, pixels, pixels * 3);
+    job->palette = (Palette){ .ptr = job->generated_palette, .len = len };
+    return 0;
+}
+
+static error job_quantise_begin(Job *job) {
+    try (job_copy_source(job));
+    return job_palette(job);
+}
+
+static void job_quantise_frame(Job *job, usize frame_i) {
+    Stats *stats = job_stats(job);
+    usize pixels = (usize)job->width * (usize)job->height;
+    usize frame_len = pixels * job->channels;
+    u8 *frame = job->data + frame_i * frame_len;
+    bool grey = job->channels == 1;
+    Stats_Mark mark = job_mark(job);
+    if (job->options->invert && !job->inverted) {
+        if (grey) image_invert_grey(frame, frame_len);
+        else image_invert(frame, frame_len);
+        stats_add(stats, STATS_INVERT, mark, pixels, frame_len);
+        mark = job_mark(job);
+    }
+    // The reference quantises its own rgb copy of the same input.
+    u8 *reference = NULL;
+    if (job->batch != NULL && job->batch->verify) {
+        reference = malloc(pixels * 3);
+        if (reference == NULL) {
+            err("allocation failure");
+            atom_store(&job->verify_failed, true);
+        } else if (grey) {
+            image_rgb_from_grey(frame, pixels, reference);
+        } else {
+            memcpy(reference, frame, frame_len);
+        }
+    }
+    if (image_conforms(frame, pixels, job->channels, job->palette)) {
+        // Quantising would leave every pixel as it is.
+    } else if (grey) {
+        image_quantise_grey(
+            frame,
+            job->width,
+            job->height,
+            job->palette,
+            job->options->algorithm
+        );
+    } else {
+        image_quantise(
+            frame,
+            job->width,
+            job->height,
+            job->palette,
+            job->options->algorithm
+        );
+    }
+    stats_add(stats, STATS_QUANTISE, mark, pixels, frame_len);
+    u8 *output = frame;
+    if (reference != NULL && grey) {
+        output = malloc(pixels * 3);
+        if (output != NULL) image_rgb_from_grey(frame, pixels, output);
+    }
+    if (reference != NULL && output == NULL) {
+        err("allocation failure");
+        atom_store(&job->verify_failed, true);
+    } else if (reference != NULL) {
+        image_quantise_reference(
+            reference,
+            job->width,
+            job->height,
+            job->palette,
+            job->options->algorithm
+        );
+        if (image_verify(
+            output, reference, job->width, job->height, job->outfile_path,
+            frame_i
+        ) != 0) {
+            atom_store(&job->verify_failed, true);
+        }
+    }
+    if (output != frame) free(output);
+    free(reference);
+}
+
+static error job_quantise(Job *job) {
+    try (job_quantise_begin(job));
+    for (usize i = 0; i < job->frames_len; i += 1) job_quantise_frame(job, i);
+    return 0;
+}
+
+static error job_encode(Job *job) {
+    Image_Animation animation = {
+        .frames_len = job->frames_len,
+        .delays = job->delays,
+        .alpha = job->alpha,
+    };
+    if (job->outfile_buffer != NULL) return image_write_buffer(
+        job->outfile_buffer,
+        job->outfile_format,
+        job->data,
+        job->width,
+        job->height,
+        job->channels,
+        job->palette,
+        &animation
+    );
+
+    FILE *file = NULL; try (job_open(job, true, &file));
+    Stats *stats = job_stats(job);
+    error e = 0;
+    if (job->passthrough) {
+        Stats_Mark mark = job_mark(job);
+        if (fwrite(job->infile.ptr, 1, job->infile.len, file) !=
+            job->infile.len
+        ) {
+            e = 1;
+        }
+        if (fflush(file) != 0) e = 1;
+        stats_add(stats, STATS_WRITE, mark, 0, job->infile.len);
+        if (e == 0 && stats != NULL) atom_add(&stats->outputs, 1);
+    } else if (stats == NULL) {
+        e = image_write(
+            file,
+            job->outfile_format,
+            job->data,
+            job->width,
+            job->height,
+            job->channels,
+            job->palette,
+            &animation
+        );
+    } else {
+        // Encoding to memory first separates the encoder's time from the
+        // file system's.
+        u64 pixels = (u64)job->width * (u64)job->height * job->frames_len;
+        Image_Buffer buf = { 0 };
+        Stats_Mark mark = job_mark(job);
+        e = image_write_buffer(
+            &buf,
+            job->outfile_format,
+            job->data,
+            job->width,
+            job->height,
+            job->channels,
+            job->palette,
+            &animation
+        );
+        stats_add(stats, STATS_ENCODE, mark, pixels, buf.len);
+        mark = job_mark(job);
+        if (e == 0 && fwrite(buf.ptr, 1, buf.len, file) != buf.len) e = 1;
+        if (fflush(file) != 0) e = 1;
+        stats_add(stats, STATS_WRITE, mark, 0, buf.len);
+        free(buf.ptr);
+        if (e == 0) atom_add(&stats->outputs, 1);
+    }
+    if (fclose(file) != 0) e = 1;
+    if (e != 0) return errf(
+        "error writing image '%.*s'", str8_fmt(job->outfile_path)
+    );
+
+    if (job->batch != NULL && job->batch->cache != NULL) cache_store(
+        job->batch->cache,
+        job_cache_key(job),
+        job->outfile_format,
+        job->dir,
+        (char *)job_outfile_name(job).ptr
+    );
+
+    if (job->quiet) return 0;
+    if (job->passthrough) {
+        printf(
+            "copied '%.*s' to '%.*s' unchanged, as it is already in the "
+                "palette\n",
+            str8_fmt(job->infile_path), str8_fmt(job->outfile_path)
+        );
+    } else {
+        printf(
+            "wrote image of size %dx%d to '%.*s'\n",
+            job->width, job->height, str8_fmt(job->outfile_path)
+        );
+    }
+    return 0;
+}
+
+static void job_finish(Job *job, error e) {
+    if (job->source != NULL) {
+        free(job->data);
+    } else {
+        stbi_image_free(job->data);
+        stbi_image_free(job->delays);
+        free(job->alpha);
+    }
+    job->data = NULL;
+    free(job->generated_palette);
+    job->generated_palette = NULL;
+    job_arena_deinit(job);
+    dir_ref_release(job->dir);
+
+    Batch *batch = job->batch;
+    Job *source = job->source;
+    Job_Done *done = job->done;
+    usize budget_bytes = job->budget_bytes;
+    // A fan-out job only fails by itself when none of its variants ran.
+    usize outputs_len = job->variants_len == 0 ? 1 : job->variants_len;
+    if (job->owned) free(job);
+
+    if (source != NULL) {
+        if (e != 0 && batch != NULL) atom_add(&batch->failed, 1);
+        if (atom_sub(&source->refs, 1) == 1) job_finish(source, 0);
+        return;
+    }
+    if (batch != NULL) {
+        if (budget_bytes != 0) budget_release(&batch->budget, budget_bytes);
+        if (e != 0) atom_add(&batch->failed, outputs_len);
+        budget_release(&batch->slots, 1);
+    }
+    if (done != NULL) {
+        // The waiter may close the job's error file as soon as it wakes.
+        err_file = NULL;
+        job_done_signal(done, e);
+    }
+}
+
+// Points the variants of a decoded fan-out job at its pixels. The job must not
+// be touched afterwards, as the last variant to finish also finishes it.
+static void job_start_variants(Job *job) {
+    job->refs = job->variants_len;
+    for (usize i = 0; i < job->variants_len; i += 1) {
+        Job *variant = &job->variants[i];
+        variant->source = job;
+        variant->batch = job->batch;
+        variant->width = job->width;
+        variant->height = job->height;
+        variant->channels = job->channels;
+        variant->frames_len = job->frames_len;
+        variant->delays = job->delays;
+        variant->alpha = job->alpha;
+    }
+}
+
+static error job_run(Job *job) {
+    error e = 0;
+    if (job->source == NULL) {
+        e = job_prepare(job);
+        if (e == 0 && job->budget_bytes != 0) {
+            budget_acquire(&job->batch->budget, job->budget_bytes);
+        }
+        if (e == 0 && !job->cached) e = job_decode(job);
+    }
+    if (e == 0 && job->variants_len != 0) {
+        Job *variants = job->variants;
+        usize variants_len = job->variants_len;
+        job_start_variants(job);
+        for (usize i = 0; i < variants_len; i += 1) {
+            if (job_run(&variants[i]) != 0) e = 1;
+        }
+        return e;
+    }
+    if (e == 0 && !job->cached) e = job_quantise(job);
+    if (e == 0 && !job->cached) e = job_encode(job);
+    if (e == 0 && job->verify_failed) e = 1;
+    job_finish(job, e);
+    return e;
+}
+
+// Called first by every task, as each may run on a different thread.
+static void job_task_begin(Job *job) {
+    err_file = job->err_file;
+}
+
+static void job_task_encode(Pool *pool, void *arg) {
+    (void)pool;
+    Job *job = arg;
+    job_task_begin(job);
+    error e = job_encode(job);
+    job_finish(job, e != 0 ? e : job->verify_failed);
+}
+
+typedef struct Job_Frame {
+    Job *job;
+    usize index;
+} Job_Frame;
+
+static void job_task_quantise_frame(Pool *pool, void *arg) {
+    Job_Frame *frame = arg;
+    Job *job = frame->job;
+    job_task_begin(job);
+    job_quantise_frame(job, frame->index);
+    if (atom_sub(&job->frames_left, 1) != 1) return;
+
+    free(job->frame_tasks);
+    job->frame_tasks = NULL;
+    Task next = { .fn = job_task_encode, .arg = job };
+    if (pool_submit(pool, next) != 0) job_finish(job, 1);
+}
+
+static void job_task_quantise(Pool *pool, void *arg) {
+    Job *job = arg;
+    job_task_begin(job);
+    if (job->cached) {
+        job_finish(job, 0);
+        return;
+    }
+    if (job_quantise_begin(job) != 0) {
+        job_finish(job, 1);
+        return;
+    }
+
+    usize frames_len = job->frames_len;
+    Job_Frame *frames = frames_len == 1 ? NULL :
+        malloc(frames_len * sizeof(Job_Frame));
+    if (frames == NULL) {
+        for (usize i = 0; i < frames_len; i += 1) job_quantise_frame(job, i);
+        Task next = { .fn = job_task_encode, .arg = job };
+        if (pool_submit(pool, next) != 0) job_finish(job, 1);
+        return;
+    }
+
+    // Frames are independent, so each is quantised as its own task and the
+    // last one to finish moves the job on to encoding.
+    job->frame_tasks = frames;
+    job->frames_left = frames_len;
+    for (usize i = 0; i < frames_len; i += 1) {
+        frames[i] = (Job_Frame){ .job = job, .index = i };
+        Task task = { .fn = job_task_quantise_frame, .arg = &frames[i] };
+        if (pool_submit(pool, task) != 0) {
+            job_task_quantise_frame(pool, &frames[i]);
+        }
+    }
+}
+
+static void job_task_decode(Pool *pool, void *arg) {
+    Job *job = arg;
+    job_task_begin(job);
+    if (!job->cached && job_decode(job) != 0) {
+        job_finish(job, 1);
+        return;
+    }
+    if (job->variants_len == 0) {
+        if (job->cached) {
+            job_finish(job, 0);
+            return;
+        }
+        Task next = { .fn = job_task_quantise, .arg = job };
+        if (pool_submit(pool, next) != 0) job_finish(job, 1);
+        return;
+    }
+
+    Job *variants = job->variants;
+    usize variants_len = job->variants_len;
+    job_start_variants(job);
+    for (usize i = 0; i < variants_len; i += 1) {
+        Task next = { .fn = job_task_quantise, .arg = &variants[i] };
+        if (pool_submit(pool, next) != 0) job_finish(&variants[i], 1);
+    }
+}
+
+static void job_task_prepare(Pool *pool, void *arg) {
+    Job *job = arg;
+    job_task_begin(job);
+    if (job_prepare(job) != 0) {
+        job_finish(job, 1);
+        return;
+    }
+    if (job->budget_bytes == 0) {
+        job_task_decode(pool, job);
+        return;
+    }
+    // Decoding goes ahead here or, if the budget is spent, once another job
+    // releases enough of it.
+    job->budget_waiter = (Budget_Waiter){
+        .bytes = job->budget_bytes,
+        .pool = pool,
+        .task = { .fn = job_task_decode, .arg = job },
+    };
+    if (budget_try_acquire(&job->batch->budget, &job->budget_waiter)) {
+        job_task_decode(pool, job);
+    }
+}
+
+// With a single worker, jobs run to completion on the submitting thread.
+static error batch_init(Batch *batch, usize workers_len, usize memory_budget) {
+    *batch = (Batch){
+        .serial = workers_len <= 1,
+        .palette_threads_len = 1,
+    };
+    budget_init(&batch->budget, memory_budget);
+    // Bounds how far a producer may run ahead of the workers, and with it the
+    // number of jobs (and open directories) alive at once.
+    budget_init(&batch->slots, 4 * workers_len);
+    if (!batch->serial) try (pool_init(&batch->pool, workers_len));
+    return 0;
+}
+
+static void batch_submit(Batch *batch, Job *job) {
+    job->batch = batch;
+    atom_add(&batch->submitted, job->variants_len == 0 ? 1 : job->variants_len);
+    budget_acquire(&batch->slots, 1);
+    if (batch->serial) {
+        job_run(job);
+        return;
+    }
+    Task task = { .fn = job_task_prepare, .arg = job };
+    if (pool_submit(&batch->pool, task) != 0) job_finish(job, 1);
+}
+
+static error batch_deinit(Batch *batch) {
+    if (!batch->serial) {
+        pool_wait(&batch->pool);
+        pool_deinit(&batch->pool);
+    }
+    budget_deinit(&batch->budget);
+    budget_deinit(&batch->slots);
+
+    if (batch->failed == 0) return 0;
+    if (batch->submitted == 1) return 1;
+    return errf(
+        "%zu of %zu images failed", batch->failed, batch->submitted
+    );
+}
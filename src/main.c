@@ -7,81 +7,202 @@ const Str8 version_text = str8("imgclr version " version_lit "\n");
 const Str8 help_text = str8(
 "imgclr - image colouriser (version " version_lit ")\n"
 "\n"
-"Usage: imgclr <input file> <output file> <palette...> [options]\n"
+"Usage: imgclr <input file> <output file> [<input file> <output file>...]\n"
+"              --palette <hex>... [options]\n"
+"       imgclr <input file> <output file>... --palette <hex>... [/ <hex>...]\n"
+"              [--dither <algorithm>...] [options]\n"
+"       imgclr --input-dir <dir> --output-dir <dir> --palette <hex>...\n"
+"              [options]\n"
+"       imgclr <input file> <output file>... --palette-from <file>:<n>\n"
+"              [options]\n"
+"       imgclr --raw-rgb <width>x<height> <input> <output> --palette <hex>...\n"
+"              [options]\n"
+"       imgclr --tiled[=<rows>] <input.ppm> <output.ppm> --palette <hex>...\n"
+"              [options]\n"
+"       imgclr --serve <socket> [--jobs <n>] [--memory-budget <MiB>]\n"
+"       imgclr --calibrate\n"
+"       imgclr --client <socket> <input file> <output file>\n"
+"              --palette <hex>... [options]\n"
 "\n"
 "Options:\n"
-"      --dither <algorithm>\n"
+"      --dither <algorithm>...\n"
 "        Specify dithering algorithm - one of:\n"
 "            'floyd-steinberg' (default), 'none', 'atkinson', 'jjn', \n"
 "            'burkes', 'sierra-lite'\n"
+"        Several algorithms may be given; see --palette\n"
 "      --invert\n"
 "        Invert the image's luminance\n"
+"      --jobs <n>\n"
+"        Number of images to process concurrently (default: number of CPUs)\n"
+"      --input-dir <dir>, --output-dir <dir>\n"
+"        Process every image under <dir> recursively, mirroring the\n"
+"        directory structure into the output directory\n"
+"      --ext <extension>\n"
+"        Output format for --input-dir (default: png)\n"
+"      --cache-dir <dir>\n"
+"        Reuse outputs stored in <dir> by earlier runs with the same input\n"
+"        and options, and store new ones there. Outputs served from the\n"
+"        cache are hard links to it where possible, so do not modify them\n"
+"        in place\n"
+"      --memory-budget <MiB>\n"
+"        Upper bound on memory held by in-flight images (default: 1024)\n"
+"      --stats[=json]\n"
+"        Report time spent and throughput per stage to stderr, as a table\n"
+"        or as JSON. On Linux, also report instructions per cycle and\n"
+"        cache and branch misses per pixel where hardware counters are\n"
+"        available\n"
+"      --calibrate\n"
+"        Time each nearest-colour search for every palette size on this\n"
+"        machine, and save the fastest for later runs to use. The file is\n"
+"        $IMGCLR_CALIBRATION, or imgclr/calibration in the configuration\n"
+"        directory\n"
+"      --verify\n"
+"        Also quantise each image with the plain reference quantiser, and\n"
+"        fail with the number of differing pixels and the first of them\n"
+"        if the output does not match it exactly\n"
+"      --passthrough\n"
+"        Copy inputs whose pixels are all palette colours to their outputs\n"
+"        unchanged, instead of encoding them again, where the input is\n"
+"        already in the output's format\n"
+"      --trace <file>\n"
+"        Write a timeline of every stage of every image on every thread\n"
+"        to <file>, in the Chrome Trace Event format that Perfetto and\n"
+"        chrome://tracing load\n"
+"      --raw-rgb <width>x<height>\n"
+"        Quantise a stream of raw rgb24 frames of the given size, such as\n"
+"        from ffmpeg's rawvideo format; paths of '-' use stdin/stdout\n"
+"      --tiled[=<rows>]\n"
+"        Quantise a binary PPM (P6) image into another in strips of <rows>\n"
+"        rows (default: 256), holding only one strip in memory, for images\n"
+"        too large to decode whole. The output is the same as without\n"
+"        strips. Paths of '-' use stdin/stdout\n"
+"      --serve <socket>\n"
+"        Run as a server, processing requests from --client on <socket>\n"
+"      --client <socket>\n"
+"        Send this invocation to a server started with --serve; paths of\n"
+"        '-' read the input from stdin and write the output to stdout, in\n"
+"        the format given by --ext (default: png)\n"
 "      --palette <hex>...\n"
 "        Specify palette - at least two (2) space-separated hex colours\n"
+"        Several palettes may be given, separated by '/'. Each input is then\n"
+"        followed by one output per palette and algorithm, ordered by\n"
+"        palette first, and is decoded only once\n"
+"        In place of hex colours, 'auto:<n>' generates a palette of up to <n>\n"
+"        colours (2-256) from each image by median cut; with --raw-rgb, from\n"
+"        the first frame. 'kmeans:<n>' refines that palette by k-means.\n"
+"        'octree:<n>[:<s>]' builds one in a single pass and fixed memory,\n"
+"        sampling every <s>th row (default: 1)\n"
+"      --palette-from <file>:<n>\n"
+"        Use a palette of up to <n> colours (2-256) extracted from the\n"
+"        reference image <file> by k-means, in place of --palette. With\n"
+"        --cache-dir, the palette is cached for later runs\n"
 "  -h, --help\n"
 "        Print this help and exit\n"
 "      --version\n"
 "        Print version information and exit\n"
 );
 
+#include "imgclr.c"
 #include "args.c"
-#include "colour.c"
-#include "dither.c"
-
-#ifndef DEBUG
-    #include "stbi.c"
-#else
-    #include "stb_image.h"
-    #include "stb_image_write.h"
-#endif // DEBUG
-
-typedef enum { FORMAT_JPG, FORMAT_PNG, FORMAT_BMP } Format;
+#include "pool.c"
+#include "dir.c"
+#include "hash.c"
+#include "cache.c"
+#include "reference.c"
+#include "clock.c"
+#include "trace.c"
+#include "stats.c"
+#include "measure.c"
+#include "calibrate.c"
+#include "job.c"
+#include "walk.c"
+#include "serve.c"
+#include "stream.c"
+#include "tile.c"
 
 typedef struct {
     Arena arena;
     int argc;
     char **argv;
-    Str8 infile_path;
-    Str8 infile;
-    Format infile_format;
-    Str8 outfile_path;
-    Str8 outfile;
-    Format outfile_format;
-    Slice(Rgb) palette;
-    uchar *data;
+    Job_Variants variants;
+    Job *jobs;
+    usize jobs_len;
+    Batch batch;
+    Cache cache;
+    bool use_cache;
+    Stats stats;
+    bool use_stats;
+    Trace trace;
+    Str8 trace_path;
 } Context;
 
-static error format_from_str(Str8 str, Format *format) {
-    usize extension_pos = str.len;
-    for (usize i = str.len; i >= 0; i--) {
-        if (str.ptr[i] != '.') continue;
-        extension_pos = i + 1;
-        break;
+// Forwards the positional paths and the options that affect the output to a
+// server started with --serve.
+static error main_client(Context *ctx, Str8 socket_path, Args_Desc *args_desc) {
+    usize request_cap = 0;
+    for (int i = 1; i < ctx->argc; i += 1) {
+        request_cap += strlen(ctx->argv[i]) + 1;
+    }
+    request_cap += 2 * 4096;
+
+    Str8 request = { 0 };
+    try (arena_alloc(&ctx->arena, request_cap, &request.ptr));
+    bool input_from_stdin = false;
+    bool skip_value = false;
+    for (int i = 1; i < ctx->argc; i += 1) {
+        Str8 arg = str8_from_cstr(ctx->argv[i]);
+        if (skip_value) {
+            skip_value = false;
+            continue;
+        }
+        bool is_flag = arg.len > 1 && arg.ptr[0] == '-';
+        usize name_end = 0;
+        while (name_end < arg.len && arg.ptr[name_end] != '=') name_end += 1;
+        Str8 name = str8_range(arg, 0, name_end);
+        if (str8_eql(name, str8("--client")) ||
+            str8_eql(name, str8("-client")) ||
+            str8_eql(name, str8("--jobs")) || str8_eql(name, str8("-jobs")) ||
+            str8_eql(name, str8("--memory-budget")) || 
+            str8_eql(name, str8("-memory-budget"))
+        ) {
+            skip_value = name_end == arg.len;
+            continue;
+        }
+        if (!is_flag && 
+            i >= args_desc->multi_pos.beg_i && i < args_desc->multi_pos.end_i
+        ) {
+            if (i == args_desc->multi_pos.beg_i) {
+                input_from_stdin = str8_eql(arg, str8("-"));
+            }
+            try (client_path_arg(&ctx->arena, arg, &arg));
+        }
+        if (request.len + arg.len + 1 > request_cap) {
+            return err("arguments too long");
+        }
+        memcpy(request.ptr + request.len, arg.ptr, arg.len);
+        request.ptr[request.len + arg.len] = '\0';
+        request.len += arg.len + 1;
     }
-    
-    if (extension_pos + 1 >= str.len) return errf(
-        "unable to infer image format from filename '%.*s'", 
-        str8_fmt(str)
-    );
 
-    Str8 ext = str8_range(str, extension_pos, str.len);
-    
-    if (str8_eql(ext, str8("jpg")) || str8_eql(ext, str8("JPG")) ||
-        str8_eql(ext, str8("jpeg")) || str8_eql(ext, str8("JPEG"))
-    ) {
-        *format = FORMAT_JPG;
-    } else if (str8_eql(ext, str8("png")) || str8_eql(ext, str8("PNG"))) {
-        *format = FORMAT_PNG;
-    } else if (str8_eql(ext, str8("bmp")) || str8_eql(ext, str8("BMP")) ||
-        str8_eql(ext, str8("dib")) || str8_eql(ext, str8("DIB"))
-    ) {
-        *format = FORMAT_BMP;
-    } else return errf(
-        "extension '%.*s' does not match any supported image format", 
-        str8_fmt(ext)
-    );
-    
-    return 0;
+    return client_run(socket_path, request, input_from_stdin);
+}
+
+// Starts the clock for --stats and --trace once the arguments have been
+// checked. Tracing alone collects the same figures without printing them.
+static Stats *main_stats(
+    Context *ctx,
+    Args_Flag *stats_flag,
+    Args_Flag *trace_flag
+) {
+    if (!stats_flag->is_present && !trace_flag->is_present) return NULL;
+    stats_init(&ctx->stats, str8_eql(stats_flag->single_pos, str8("json")));
+    ctx->use_stats = stats_flag->is_present;
+    if (trace_flag->is_present) {
+        trace_init(&ctx->trace, ctx->stats.beg_ns);
+        ctx->stats.trace = &ctx->trace;
+        ctx->trace_path = trace_flag->single_pos;
+    }
+    return &ctx->stats;
 }
 
 static error main_wrapper(Context *ctx) {
@@ -90,12 +211,67 @@ static error main_wrapper(Context *ctx) {
     Args_Flag invert_flag = { .name = str8("invert") };
     Args_Flag dither_flag = { 
         .name = str8("dither"), 
-        .kind = args_kind_single_pos, 
+        .kind = args_kind_multi_pos, 
     };
     Args_Flag palette_flag = {
         .name = str8("palette"),
         .kind = args_kind_multi_pos,
     };
+    Args_Flag palette_from_flag = {
+        .name = str8("palette-from"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag jobs_flag = {
+        .name = str8("jobs"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag memory_budget_flag = {
+        .name = str8("memory-budget"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag input_dir_flag = {
+        .name = str8("input-dir"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag output_dir_flag = {
+        .name = str8("output-dir"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag ext_flag = {
+        .name = str8("ext"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag cache_dir_flag = {
+        .name = str8("cache-dir"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag raw_rgb_flag = {
+        .name = str8("raw-rgb"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag stats_flag = {
+        .name = str8("stats"),
+        .kind = args_kind_optional_pos,
+    };
+    Args_Flag trace_flag = {
+        .name = str8("trace"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag tiled_flag = {
+        .name = str8("tiled"),
+        .kind = args_kind_optional_pos,
+    };
+    Args_Flag verify_flag = { .name = str8("verify") };
+    Args_Flag passthrough_flag = { .name = str8("passthrough") };
+    Args_Flag calibrate_flag = { .name = str8("calibrate") };
+    Args_Flag serve_flag = {
+        .name = str8("serve"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag client_flag = {
+        .name = str8("client"),
+        .kind = args_kind_single_pos,
+    };
     Args_Flag help_flag_short = { .name = str8("h") };
     Args_Flag help_flag_long = { .name = str8("help") };
     Args_Flag version_flag = { .name = str8("version") };
@@ -103,6 +279,22 @@ static error main_wrapper(Context *ctx) {
         &dither_flag,
         &invert_flag, 
         &palette_flag,
+        &palette_from_flag,
+        &jobs_flag,
+        &memory_budget_flag,
+        &input_dir_flag,
+        &output_dir_flag,
+        &ext_flag,
+        &cache_dir_flag,
+        &raw_rgb_flag,
+        &tiled_flag,
+        &stats_flag,
+        &trace_flag,
+        &verify_flag,
+        &passthrough_flag,
+        &calibrate_flag,
+        &serve_flag,
+        &client_flag,
         &help_flag_short, &help_flag_long,
         &version_flag,
     };
@@ -122,197 +314,285 @@ static error main_wrapper(Context *ctx) {
         return 0;
     }
 
-    usize positional_args_len = 
-        args_desc.multi_pos.end_i - args_desc.multi_pos.beg_i;
-    if (positional_args_len < 2) return err(
-        "expected input and output paths as positional arguments"
-    );
+    if (calibrate_flag.is_present) {
+        if (args_desc.multi_pos.end_i != args_desc.multi_pos.beg_i) return err(
+            "unexpected positional arguments with --calibrate"
+        );
+        return calibrate_run(&ctx->arena);
+    }
+    try (calibrate_load(&ctx->arena));
 
-    usize palette_len = args_desc.multi_pos.end_i - args_desc.multi_pos.beg_i;
-    if (!palette_flag.is_present || palette_len < 2) {
-        return err("expected at least two (2) palette colours");
+    usize workers_len = cpu_count();
+    if (jobs_flag.is_present) {
+        try (usize_from_str8(jobs_flag.single_pos, &workers_len));
+        if (workers_len == 0) return err("expected at least one (1) job");
     }
 
-    ctx->infile_path = str8_from_cstr(ctx->argv[args_desc.multi_pos.beg_i]);
-    ctx->outfile_path = 
-        str8_from_cstr(ctx->argv[args_desc.multi_pos.beg_i + 1]);
-
-    try (format_from_str(ctx->outfile_path, &ctx->outfile_format));
-
-    Dither_Algorithm algorithm = floyd_steinberg;
-    if (dither_flag.is_present) {
-        Str8 s = dither_flag.single_pos;
-        if (str8_eql(s, str8("floyd-steinberg"))) {
-            algorithm = floyd_steinberg;
-        } else if (str8_eql(s, str8("none"))) {
-            algorithm = none;
-        } else if (str8_eql(s, str8("atkinson"))) {
-            algorithm = atkinson;
-        } else if (str8_eql(s, str8("jjn"))) {
-            algorithm = jjn;
-        } else if (str8_eql(s, str8("burkes"))) {
-            algorithm = burkes;
-        } else if (str8_eql(s, str8("sierra-lite"))) {
-            algorithm = sierra_lite;
-        } else return errf(
-            "invalid algorithm '%.*s'", 
-            str8_fmt(dither_flag.single_pos)
+    if (stats_flag.is_present) {
+        if (stats_flag.single_pos.len != 0 &&
+            !str8_eql(stats_flag.single_pos, str8("json"))
+        ) {
+            return errf(
+                "unknown stats format '%.*s'", str8_fmt(stats_flag.single_pos)
+            );
+        }
+        if (serve_flag.is_present || client_flag.is_present) return err(
+            "--stats is not valid with --serve or --client"
         );
     }
-
-    try (
-        arena_alloc(&ctx->arena, palette_len * sizeof(Rgb), &ctx->palette.ptr)
-    );
-    for (
-        int i = palette_flag.multi_pos.beg_i; 
-        i < palette_flag.multi_pos.end_i; 
-        i += 1
+    if (trace_flag.is_present &&
+        (serve_flag.is_present || client_flag.is_present)
     ) {
-        Str8 hex_str = str8_from_cstr(ctx->argv[i]);
-        Rgb rgb; try (rgb_from_hex_str8(hex_str, &rgb));
-        slice_push(ctx->palette, rgb);
+        return err("--trace is not valid with --serve or --client");
+    }
+    // Outputs served from the cache would go unchecked.
+    if (verify_flag.is_present && (serve_flag.is_present ||
+        client_flag.is_present || cache_dir_flag.is_present ||
+        tiled_flag.is_present)
+    ) {
+        return err(
+            "--verify is not valid with --serve, --client, --cache-dir or "
+                "--tiled"
+        );
+    }
+    if (passthrough_flag.is_present && (serve_flag.is_present ||
+        client_flag.is_present || raw_rgb_flag.is_present ||
+        tiled_flag.is_present)
+    ) {
+        return err(
+            "--passthrough is not valid with --serve, --client, --raw-rgb or "
+                "--tiled"
+        );
     }
 
-    Str8 infile_buf; try (
-        file_read(&ctx->arena, ctx->infile_path, "rb", &infile_buf)
-    );
-
-    int width = 0, height = 0, channels = 0;
-    ctx->data = stbi_load_from_memory(
-        infile_buf.ptr, 
-        (int)infile_buf.len,
-        &width, 
-        &height, 
-        &channels, 
-        3
+    usize memory_budget_mib = 1024;
+    if (memory_budget_flag.is_present) try (
+        usize_from_str8(memory_budget_flag.single_pos, &memory_budget_mib)
     );
-    if (ctx->data == NULL) return errf(
-        "error loading '%.*s':\n%s", 
-        str8_fmt(ctx->infile_path), stbi_failure_reason()
+    if (memory_budget_mib > SIZE_MAX / (1024 * 1024)) return errf(
+        "memory budget of %zu MiB is too large", memory_budget_mib
     );
+    usize memory_budget = memory_budget_mib * 1024 * 1024;
 
-    usize data_len = width * height * channels;
-
-    uchar *data = ctx->data;
-    if (invert_flag.is_present) for (usize i = 0; i < data_len; i += 3) {
-        i16 brightness = (data[i + 0] + data[i + 1] + data[i + 2]) / 3;
-        i16 r_relative = data[i + 0] - brightness;
-        i16 g_relative = data[i + 1] - brightness;
-        i16 b_relative = data[i + 2] - brightness;
-
-        i16 new_r = (255 - brightness) + r_relative;
-        i16 new_g = (255 - brightness) + g_relative;
-        i16 new_b = (255 - brightness) + b_relative;
-
-        clamp(new_r, 0, 255); 
-        clamp(new_g, 0, 255); 
-        clamp(new_b, 0, 255); 
-
-        data[i + 0] = (u8)new_r;
-        data[i + 1] = (u8)new_g;
-        data[i + 2] = (u8)new_b;
+    if (serve_flag.is_present) {
+        return serve_run(serve_flag.single_pos, workers_len, memory_budget);
     }
 
-    // NOTE (OUTDATED): Having several loops to avoid bounds checking on the
-    // majority of the image is not worth it.
-
-    for (usize i = 0; i < data_len; i += channels) {
-        u16 min_diff = 999;
-        usize best_match = 0;
-        for (usize j = 0; j < ctx->palette.len; j += 1) {
-            u16 diff_total = (u16)abs(data[i + 0] - ctx->palette.ptr[j].r) +
-                             (u16)abs(data[i + 1] - ctx->palette.ptr[j].g) +
-                             (u16)abs(data[i + 2] - ctx->palette.ptr[j].b);
-            if (diff_total < min_diff) {
-                min_diff = diff_total;
-                best_match = j;
-            }
+    usize positional_args_len = 
+        args_desc.multi_pos.end_i - args_desc.multi_pos.beg_i;
+    bool dir_mode = input_dir_flag.is_present || output_dir_flag.is_present;
+    if (dir_mode) {
+        if (!input_dir_flag.is_present || !output_dir_flag.is_present) {
+            return err("expected both --input-dir and --output-dir");
         }
+        if (positional_args_len != 0) return err(
+            "unexpected positional arguments with --input-dir"
+        );
+    } else {
+        if (positional_args_len < 2) return err(
+            "expected input and output paths as positional arguments"
+        );
+        if (ext_flag.is_present && !client_flag.is_present) return err(
+            "--ext is only valid with --input-dir or --client"
+        );
+    }
 
-        i16 quant_err[3] = {
-            (i16)data[i + 0] - ctx->palette.ptr[best_match].r,
-            (i16)data[i + 1] - ctx->palette.ptr[best_match].g,
-            (i16)data[i + 2] - ctx->palette.ptr[best_match].b
-        };
+    if (cache_dir_flag.is_present && (raw_rgb_flag.is_present ||
+        tiled_flag.is_present || client_flag.is_present)
+    ) {
+        return err(
+            "--cache-dir is not valid with --raw-rgb, --tiled or --client"
+        );
+    }
+    if (cache_dir_flag.is_present) {
+        try (cache_open(cache_dir_flag.single_pos, version_text, &ctx->cache));
+        ctx->use_cache = true;
+    }
 
-        data[i + 0] = ctx->palette.ptr[best_match].r;
-        data[i + 1] = ctx->palette.ptr[best_match].g;
-        data[i + 2] = ctx->palette.ptr[best_match].b;
-
-        usize current_x = (i / channels) % width;
-        usize current_y = (i / channels) / width;
-        for (usize j = 0; j < algorithm.len; j++) {
-            i64 target_x = current_x + algorithm.ptr[j].x_offset;
-            i64 target_y = current_y + algorithm.ptr[j].y_offset;
-            if (target_x < 0 || target_x >= width || 
-                target_y < 0 || target_y >= height
-            ) {
-                continue;
-            }
+    Palette reference = { 0 };
+    if (palette_from_flag.is_present) {
+        if (palette_flag.is_present) return err(
+            "expected either --palette or --palette-from, not both"
+        );
+        if (client_flag.is_present) return err(
+            "--palette-from is not valid with --client"
+        );
+        try (reference_palette(
+            &ctx->arena,
+            ctx->use_cache ? &ctx->cache : NULL,
+            palette_from_flag.single_pos,
+            &reference
+        ));
+    }
+
+    try (job_variants_from_flags(
+        &ctx->arena, 
+        ctx->argv, 
+        &palette_flag, 
+        palette_from_flag.is_present ? &reference : NULL,
+        &dither_flag, 
+        &invert_flag, 
+        &ctx->variants
+    ));
+    usize variants_len = ctx->variants.len;
+    if (variants_len > 1 && (dir_mode || client_flag.is_present)) return err(
+        "expected a single palette and dither algorithm with --input-dir "
+            "or --client"
+    );
 
-            usize target_i = channels * (target_y * width + target_x);
-            i16 new_r = (i16)data[target_i + 0] + 
-                (i16)((double)quant_err[0] * algorithm.ptr[j].factor);
-            i16 new_g = (i16)data[target_i + 1] + 
-                (i16)((double)quant_err[1] * algorithm.ptr[j].factor);
-            i16 new_b = (i16)data[target_i + 2] + 
-                (i16)((double)quant_err[2] * algorithm.ptr[j].factor);
-
-            clamp(new_r, 0, 255);
-            clamp(new_g, 0, 255);
-            clamp(new_b, 0, 255);
-
-            data[target_i + 0] = (u8)new_r;
-            data[target_i + 1] = (u8)new_g;
-            data[target_i + 2] = (u8)new_b;
+    // Each input is followed by one output per variant.
+    usize group_len = 1 + variants_len;
+    if (!dir_mode && positional_args_len % group_len != 0) {
+        if (variants_len == 1) {
+            return err("expected input and output paths in pairs");
         }
+        return errf(
+            "expected each input path to be followed by %zu output paths",
+            variants_len
+        );
     }
-    ctx->data = data;
-
-    bool write_ok = false;
-    switch (ctx->outfile_format) {
-        case FORMAT_JPG: {
-            write_ok = stbi_write_jpg(
-                (const char *)ctx->outfile_path.ptr, 
-                width, 
-                height, 
-                channels, 
-                ctx->data, 
-                100
+
+    if (raw_rgb_flag.is_present) {
+        if (dir_mode || client_flag.is_present || positional_args_len != 2 ||
+            variants_len != 1
+        ) {
+            return err(
+                "expected a single input and output path, palette and dither "
+                    "algorithm with --raw-rgb"
             );
-        } break;
-        case FORMAT_PNG: {
-            int stride_in_bytes = width * channels;
-            write_ok = stbi_write_png(
-                (const char *)ctx->outfile_path.ptr, 
-                width, 
-                height, 
-                channels, 
-                ctx->data, 
-                stride_in_bytes
+        }
+        Str8 size = raw_rgb_flag.single_pos;
+        usize x_i = 0;
+        while (x_i < size.len && size.ptr[x_i] != 'x') x_i += 1;
+        usize width = 0, height = 0;
+        if (x_i == size.len ||
+            usize_from_str8(str8_range(size, 0, x_i), &width) != 0 ||
+            usize_from_str8(str8_range(size, x_i + 1, size.len), &height) != 0
+        ) {
+            return errf(
+                "expected frame size as <width>x<height>, got '%.*s'",
+                str8_fmt(size)
             );
-        } break;
-        case FORMAT_BMP: {
-            write_ok = stbi_write_bmp(
-                (const char *)ctx->outfile_path.ptr, 
-                width, 
-                height, 
-                channels, 
-                ctx->data
+        }
+        int arg_i = args_desc.multi_pos.beg_i;
+        Stats *stats = main_stats(ctx, &stats_flag, &trace_flag);
+        return stream_run(
+            &ctx->variants.ptr[0],
+            width,
+            height,
+            workers_len,
+            stats,
+            verify_flag.is_present,
+            str8_from_cstr(ctx->argv[arg_i]),
+            str8_from_cstr(ctx->argv[arg_i + 1])
+        );
+    }
+
+    if (tiled_flag.is_present) {
+        if (dir_mode || client_flag.is_present || raw_rgb_flag.is_present ||
+            positional_args_len != 2 || variants_len != 1
+        ) {
+            return err(
+                "expected a single input and output path, palette and dither "
+                    "algorithm with --tiled"
             );
-        } break;
+        }
+        usize strip_rows = tile_rows_default;
+        if (tiled_flag.single_pos.len != 0) {
+            try (usize_from_str8(tiled_flag.single_pos, &strip_rows));
+            if (strip_rows == 0) return err("expected at least one (1) row");
+        }
+        int arg_i = args_desc.multi_pos.beg_i;
+        return tile_run(
+            &ctx->variants.ptr[0],
+            strip_rows,
+            main_stats(ctx, &stats_flag, &trace_flag),
+            str8_from_cstr(ctx->argv[arg_i]),
+            str8_from_cstr(ctx->argv[arg_i + 1])
+        );
     }
 
-    if (!write_ok) return errf(
-        "error writing image '%.*s'\n", 
-        str8_fmt(ctx->outfile_path)
-    );
+    if (client_flag.is_present) {
+        if (dir_mode || positional_args_len != 2) return err(
+            "expected a single input and output path with --client"
+        );
+        return main_client(ctx, client_flag.single_pos, &args_desc);
+    }
 
-    printf(
-        "wrote image of size %dx%d to '%.*s'\n", 
-        width, height, str8_fmt(ctx->outfile_path)
-    );
-    return 0;
+
+    if (dir_mode) {
+        Str8 ext = ext_flag.is_present ? ext_flag.single_pos : str8("png");
+        Walk walk = {
+            .batch = &ctx->batch,
+            .options = &ctx->variants.ptr[0],
+            .ext = ext,
+        };
+        try (format_from_ext(ext, &walk.outfile_format));
+
+        try (batch_init(&ctx->batch, workers_len, memory_budget));
+        if (ctx->use_cache) ctx->batch.cache = &ctx->cache;
+        ctx->batch.verify = verify_flag.is_present;
+        ctx->batch.passthrough = passthrough_flag.is_present;
+        ctx->batch.stats = main_stats(ctx, &stats_flag, &trace_flag);
+        error walk_e = walk_tree(
+            &walk, input_dir_flag.single_pos, output_dir_flag.single_pos
+        );
+        error batch_e = batch_deinit(&ctx->batch);
+        if (walk_e != 0) return walk_e;
+        if (walk.found == 0) return errf(
+            "no images found in '%.*s'", str8_fmt(input_dir_flag.single_pos)
+        );
+        return batch_e;
+    }
+
+    ctx->jobs_len = positional_args_len / group_len;
+    usize outputs_len = ctx->jobs_len * variants_len;
+    try (arena_alloc(&ctx->arena, ctx->jobs_len * sizeof(Job), &ctx->jobs));
+    for (usize i = 0; i < ctx->jobs_len; i += 1) {
+        int arg_i = args_desc.multi_pos.beg_i + (int)(group_len * i);
+        Job *job = &ctx->jobs[i];
+        *job = (Job){
+            .options = &ctx->variants.ptr[0],
+            .infile_path = str8_from_cstr(ctx->argv[arg_i]),
+            .outfile_path = str8_from_cstr(ctx->argv[arg_i + 1]),
+        };
+        if (variants_len == 1) {
+            try (format_from_str(job->outfile_path, &job->outfile_format));
+            continue;
+        }
+
+        job->outfile_path = (Str8){ 0 };
+        job->variants_len = variants_len;
+        try (arena_alloc(
+            &ctx->arena, variants_len * sizeof(Job), &job->variants
+        ));
+        for (usize j = 0; j < variants_len; j += 1) {
+            Job *variant = &job->variants[j];
+            *variant = (Job){
+                .options = &ctx->variants.ptr[j],
+                .infile_path = job->infile_path,
+                .outfile_path = str8_from_cstr(ctx->argv[arg_i + 1 + (int)j]),
+            };
+            try (format_from_str(
+                variant->outfile_path, &variant->outfile_format
+            ));
+        }
+    }
+
+    try (batch_init(
+        &ctx->batch, 
+        outputs_len == 1 ? 1 : workers_len, 
+        memory_budget
+    ));
+    if (ctx->use_cache) ctx->batch.cache = &ctx->cache;
+    if (outputs_len == 1) ctx->batch.palette_threads_len = workers_len;
+    ctx->batch.verify = verify_flag.is_present;
+    ctx->batch.passthrough = passthrough_flag.is_present;
+    ctx->batch.stats = main_stats(ctx, &stats_flag, &trace_flag);
+    for (usize i = 0; i < ctx->jobs_len; i += 1) {
+        batch_submit(&ctx->batch, &ctx->jobs[i]);
+    }
+    return batch_deinit(&ctx->batch);
 }
 
 int main(int argc, char **argv) {
@@ -323,7 +603,12 @@ int main(int argc, char **argv) {
 
     Context ctx = { .argc = argc, .argv = argv };
     error e = main_wrapper(&ctx);
-    stbi_image_free(ctx.data);
+    if (ctx.use_cache) cache_close(&ctx.cache);
+    if (ctx.use_stats) stats_print(&ctx.stats, &ctx.arena);
+    if (ctx.stats.trace != NULL) {
+        if (trace_write(&ctx.trace, ctx.trace_path) != 0) e = 1;
+        trace_deinit(&ctx.trace);
+    }
     arena_deinit(&ctx.arena);
     return e;
 }
@@ -0,0 +1,162 @@
+// Times the nearest-colour searches of search.c against each other, for
+// `imgclr --calibrate` and `imgclr-bench --search`.
+
+#define measure_pixels_len (1 << 19)
+
+typedef enum Measure_Pixels {
+    // Colours from anywhere in the cube, each different.
+    MEASURE_UNIFORM,
+    // Slowly drifting colours with grain, as in photographs.
+    MEASURE_PHOTO,
+    // A few dozen flat colours, as in artwork.
+    MEASURE_FLAT,
+    MEASURE_PIXELS_LEN,
+} Measure_Pixels;
+
+static const char *measure_pixels_names[MEASURE_PIXELS_LEN] = {
+    "uniform", "photo", "flat",
+};
+
+// The timings for one palette size class of the dispatch table, in
+// nanoseconds per pixel. Searches that do not support the size are left out.
+typedef struct Measure_Row {
+    usize palette_len;
+    f64 ns[SEARCH_KINDS_LEN];
+    Search_Kind fastest;
+} Measure_Row;
+
+// xorshift64*, so that every run measures the same pixels.
+static u64 measure_random(u64 *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static u8 measure_drift(u8 v, u64 r) {
+    i16 next = (i16)v + (i16)(r & 15) - 7;
+    clamp(next, 0, 255);
+    return (u8)next;
+}
+
+static void measure_pixels_generate(Measure_Pixels kind, u8 *out) {
+    u64 state = 0x9e3779b97f4a7c15ull + kind;
+    u8 flat[64][3];
+    for (usize i = 0; i < count_of(flat); i += 1) {
+        u64 r = measure_random(&state);
+        flat[i][0] = (u8)r, flat[i][1] = (u8)(r >> 8);
+        flat[i][2] = (u8)(r >> 16);
+    }
+    u8 *prev = flat[0];
+    for (usize i = 0; i < measure_pixels_len; i += 1) {
+        u8 *pixel = out + 3 * i;
+        u64 r = measure_random(&state);
+        switch (kind) {
+            case MEASURE_PHOTO: {
+                pixel[0] = measure_drift(prev[0], r);
+                pixel[1] = measure_drift(prev[1], r >> 4);
+                pixel[2] = measure_drift(prev[2], r >> 8);
+                prev = pixel;
+            } break;
+            case MEASURE_FLAT: {
+                memcpy(pixel, flat[(r >> 32) % count_of(flat)], 3);
+            } break;
+            default: {
+                pixel[0] = (u8)r, pixel[1] = (u8)(r >> 8);
+                pixel[2] = (u8)(r >> 16);
+            } break;
+        }
+    }
+}
+
+// Quantises a fresh copy of `pixels` with `kind`, keeping the fastest of
+// `repeat` runs. The time for SEARCH_LUT includes making its memo, as
+// image_quantise_memo does for each image.
+static f64 measure_time(
+    Search_Kind kind,
+    Palette palette,
+    const u8 *pixels,
+    u8 *scratch,
+    usize repeat
+) {
+    u64 best_ns = 0;
+    for (usize run = 0; run < repeat; run += 1) {
+        memcpy(scratch, pixels, measure_pixels_len * 3);
+        u64 beg_ns = clock_now();
+        Search search;
+        search_init(&search, palette, kind);
+        u8 *memo = NULL;
+        if (kind == SEARCH_LUT) memo = calloc(image_memo_len, 1);
+        image_quantise_search(
+            scratch, measure_pixels_len, 1, &search, none, memo
+        );
+        free(memo);
+        u64 ns = clock_now() - beg_ns;
+        if (run == 0 || ns < best_ns) best_ns = ns;
+    }
+    return (f64)best_ns / measure_pixels_len;
+}
+
+// Measures each size class at its largest palette, short of the memo's limit.
+static error measure_searches(
+    Measure_Pixels pixels_kind,
+    usize repeat,
+    Measure_Row rows[search_table_len]
+) {
+    u8 *pixels = malloc(measure_pixels_len * 3);
+    u8 *scratch = malloc(measure_pixels_len * 3);
+    if (pixels == NULL || scratch == NULL) {
+        free(pixels);
+        free(scratch);
+        return err("allocation failure");
+    }
+    measure_pixels_generate(pixels_kind, pixels);
+
+    u64 state = 0x2545f4914f6cdd1dull;
+    Rgb colours[search_palette_max];
+    for (usize i = 0; i < search_palette_max; i += 1) {
+        u64 r = measure_random(&state);
+        colours[i] = (Rgb){
+            .r = (u8)r, .g = (u8)(r >> 8), .b = (u8)(r >> 16),
+        };
+    }
+    for (usize i = 0; i < search_table_len; i += 1) {
+        Measure_Row *row = &rows[i];
+        row->palette_len = (usize)1 << i;
+        if (row->palette_len > image_memo_palette_max) {
+            row->palette_len = image_memo_palette_max;
+        }
+        Palette palette = { .ptr = colours, .len = row->palette_len };
+        row->fastest = SEARCH_SCALAR;
+        for (usize kind = 0; kind < SEARCH_KINDS_LEN; kind += 1) {
+            row->ns[kind] = 0;
+            if (!search_kind_supports(kind, row->palette_len)) continue;
+            row->ns[kind] = measure_time(
+                kind, palette, pixels, scratch, repeat
+            );
+            if (row->ns[kind] < row->ns[row->fastest]) row->fastest = kind;
+        }
+    }
+    free(pixels);
+    free(scratch);
+    return 0;
+}
+
+static void measure_print(FILE *out, const Measure_Row *rows) {
+    fprintf(out, "%7s", "colours");
+    for (usize kind = 0; kind < SEARCH_KINDS_LEN; kind += 1) {
+        fprintf(out, " %8s", search_kind_names[kind]);
+    }
+    fprintf(out, "  fastest (ns/pixel)\n");
+    for (usize i = 0; i < search_table_len; i += 1) {
+        fprintf(out, "%7zu", rows[i].palette_len);
+        for (usize kind = 0; kind < SEARCH_KINDS_LEN; kind += 1) {
+            if (search_kind_supports(kind, rows[i].palette_len)) {
+                fprintf(out, " %8.2f", rows[i].ns[kind]);
+            } else {
+                fprintf(out, " %8s", "-");
+            }
+        }
+        fprintf(out, "  %s\n", search_kind_names[rows[i].fastest]);
+    }
+}
@@ -0,0 +1,688 @@
+// Palettes derived from the image being quantised, requested on the command
+// line in place of hex colours, e.g. `--palette auto:16`, `kmeans:16` or
+// `octree:16:4`.
+
+#define palette_generated_max 256
+
+typedef enum {
+    PALETTE_GIVEN = 0,
+    PALETTE_MEDIAN_CUT,
+    PALETTE_KMEANS,
+    PALETTE_OCTREE,
+} Palette_Method;
+
+typedef struct {
+    Palette_Method method;
+    usize colours_len;
+    // Only every `row_stride`th row is sampled; octree only.
+    usize row_stride;
+} Palette_Spec;
+
+// Sets `*is_spec` to false if `s` is not a palette spec at all, so that it can
+// be parsed as a hex colour instead; malformed specs are reported as errors.
+static maybe_unused error palette_spec_from_str8(
+    Str8 s,
+    Palette_Spec *out,
+    bool *is_spec
+) {
+    *is_spec = false;
+    usize colon = 0;
+    while (colon < s.len && s.ptr[colon] != ':') colon += 1;
+    if (colon == s.len) return 0;
+
+    Str8 name = str8_range(s, 0, colon);
+    if (str8_eql(name, str8("auto"))) {
+        out->method = PALETTE_MEDIAN_CUT;
+    } else if (str8_eql(name, str8("kmeans"))) {
+        out->method = PALETTE_KMEANS;
+    } else if (str8_eql(name, str8("octree"))) {
+        out->method = PALETTE_OCTREE;
+    } else {
+        return errf("unknown palette generator '%.*s'", str8_fmt(name));
+    }
+    *is_spec = true;
+
+    usize stride_colon = colon + 1;
+    while (stride_colon < s.len && s.ptr[stride_colon] != ':') {
+        stride_colon += 1;
+    }
+    Str8 colours_str = str8_range(s, colon + 1, stride_colon);
+    try (usize_from_str8(colours_str, &out->colours_len));
+    if (out->colours_len < 2 || out->colours_len > palette_generated_max) {
+        return errf(
+            "expected between 2 and %d colours in '%.*s'",
+            palette_generated_max, str8_fmt(s)
+        );
+    }
+
+    out->row_stride = 1;
+    if (stride_colon == s.len) return 0;
+    if (out->method != PALETTE_OCTREE) {
+        return errf("only octree takes a row stride, in '%.*s'", str8_fmt(s));
+    }
+    Str8 stride_str = str8_range(s, stride_colon + 1, s.len);
+    try (usize_from_str8(stride_str, &out->row_stride));
+    if (out->row_stride == 0) {
+        return errf(
+            "expected a row stride of at least 1 in '%.*s'", str8_fmt(s)
+        );
+    }
+    return 0;
+}
+
+// Colours are counted at 5 bits per channel, which keeps the histogram small
+// enough to stay in cache while losing little that a palette could show.
+#define palette_hist_bits 5
+#define palette_hist_len (1 << (3 * palette_hist_bits))
+
+typedef struct Palette_Hist {
+    u32 counts[palette_hist_len];
+    // Channel sums per bin, so that box averages use the exact colours.
+    u64 sums[palette_hist_len][3];
+} Palette_Hist;
+
+static usize palette_hist_index(u8 r, u8 g, u8 b) {
+    const int shift = 8 - palette_hist_bits;
+    return ((usize)(r >> shift) << (2 * palette_hist_bits)) |
+        ((usize)(g >> shift) << palette_hist_bits) |
+        (usize)(b >> shift);
+}
+
+static void palette_hist_add(Palette_Hist *hist, const u8 *data, usize len) {
+    for (usize i = 0; i < len; i += 3) {
+        usize bin = palette_hist_index(data[i + 0], data[i + 1], data[i + 2]);
+        hist->counts[bin] += 1;
+        hist->sums[bin][0] += data[i + 0];
+        hist->sums[bin][1] += data[i + 1];
+        hist->sums[bin][2] += data[i + 2];
+    }
+}
+
+static u8 palette_bin_channel(u32 bin, usize channel) {
+    usize shift = (2 - channel) * palette_hist_bits;
+    return (u8)((bin >> shift) & ((1 << palette_hist_bits) - 1));
+}
+
+typedef struct {
+    // Range of `Palette_Median_Cut.bins`.
+    usize beg;
+    usize end;
+    u64 population;
+    u8 lo[3];
+    u8 hi[3];
+} Palette_Box;
+
+typedef struct {
+    u32 *bins;
+    u32 *scratch;
+    Palette_Box boxes[palette_generated_max];
+    usize boxes_len;
+} Palette_Median_Cut;
+
+static void palette_box_shrink(
+    Palette_Median_Cut *cut,
+    const Palette_Hist *hist,
+    Palette_Box *box
+) {
+    box->population = 0;
+    for (usize c = 0; c < 3; c += 1) {
+        box->lo[c] = (1 << palette_hist_bits) - 1;
+        box->hi[c] = 0;
+    }
+    for (usize i = box->beg; i < box->end; i += 1) {
+        u32 bin = cut->bins[i];
+        box->population += hist->counts[bin];
+        for (usize c = 0; c < 3; c += 1) {
+            u8 v = palette_bin_channel(bin, c);
+            if (v < box->lo[c]) box->lo[c] = v;
+            if (v > box->hi[c]) box->hi[c] = v;
+        }
+    }
+}
+
+// Splits the box at the population median of its longest side. Returns false
+// if it holds a single bin.
+static bool palette_box_split(
+    Palette_Median_Cut *cut,
+    const Palette_Hist *hist,
+    Palette_Box *box,
+    Palette_Box *out
+) {
+    if (box->end - box->beg < 2) return false;
+    usize axis = 0;
+    for (usize c = 1; c < 3; c += 1) {
+        if (box->hi[c] - box->lo[c] > box->hi[axis] - box->lo[axis]) axis = c;
+    }
+
+    // Counting sort along the axis; there are only 32 possible values.
+    usize offsets[(1 << palette_hist_bits) + 1] = { 0 };
+    for (usize i = box->beg; i < box->end; i += 1) {
+        offsets[palette_bin_channel(cut->bins[i], axis) + 1] += 1;
+    }
+    for (usize v = 1; v < count_of(offsets); v += 1) {
+        offsets[v] += offsets[v - 1];
+    }
+    for (usize i = box->beg; i < box->end; i += 1) {
+        u32 bin = cut->bins[i];
+        cut->scratch[box->beg + offsets[palette_bin_channel(bin, axis)]] = bin;
+        offsets[palette_bin_channel(bin, axis)] += 1;
+    }
+    memcpy(
+        cut->bins + box->beg,
+        cut->scratch + box->beg,
+        (box->end - box->beg) * sizeof(u32)
+    );
+
+    // Both halves keep at least one bin.
+    usize split = box->beg + 1;
+    u64 below = hist->counts[cut->bins[box->beg]];
+    while (split < box->end - 1 && 2 * below < box->population) {
+        below += hist->counts[cut->bins[split]];
+        split += 1;
+    }
+
+    *out = (Palette_Box){ .beg = split, .end = box->end };
+    box->end = split;
+    palette_box_shrink(cut, hist, box);
+    palette_box_shrink(cut, hist, out);
+    return true;
+}
+
+static void palette_box_average(
+    const Palette_Median_Cut *cut,
+    const Palette_Hist *hist,
+    const Palette_Box *box,
+    Rgb *out
+) {
+    u64 sums[3] = { 0 };
+    for (usize i = box->beg; i < box->end; i += 1) {
+        for (usize c = 0; c < 3; c += 1) sums[c] += hist->sums[cut->bins[i]][c];
+    }
+    u64 half = box->population / 2;
+    *out = (Rgb){
+        .r = (u8)((sums[0] + half) / box->population),
+        .g = (u8)((sums[1] + half) / box->population),
+        .b = (u8)((sums[2] + half) / box->population),
+    };
+}
+
+// Repeatedly splits the box with the largest population times longest side,
+// so that both common and widely spread colours get their share of entries.
+static error palette_median_cut(
+    const Palette_Hist *hist,
+    usize colours_len,
+    Rgb *out,
+    usize *out_len
+) {
+    Palette_Median_Cut cut = { 0 };
+    cut.bins = malloc(2 * palette_hist_len * sizeof(u32));
+    if (cut.bins == NULL) return err("allocation failure");
+    cut.scratch = cut.bins + palette_hist_len;
+
+    usize bins_len = 0;
+    for (u32 bin = 0; bin < palette_hist_len; bin += 1) {
+        if (hist->counts[bin] != 0) cut.bins[bins_len++] = bin;
+    }
+    *out_len = 0;
+    if (bins_len == 0) {
+        free(cut.bins);
+        return 0;
+    }
+
+    cut.boxes[0] = (Palette_Box){ .beg = 0, .end = bins_len };
+    palette_box_shrink(&cut, hist, &cut.boxes[0]);
+    cut.boxes_len = 1;
+    while (cut.boxes_len < colours_len) {
+        usize best = cut.boxes_len;
+        u64 best_score = 0;
+        for (usize i = 0; i < cut.boxes_len; i += 1) {
+            Palette_Box *box = &cut.boxes[i];
+            if (box->end - box->beg < 2) continue;
+            u8 longest = 0;
+            for (usize c = 0; c < 3; c += 1) {
+                u8 side = box->hi[c] - box->lo[c];
+                if (side > longest) longest = side;
+            }
+            u64 score = box->population * (u64)(longest + 1);
+            if (best == cut.boxes_len || score > best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+        if (best == cut.boxes_len) break;
+        Palette_Box *box = &cut.boxes[best];
+        if (!palette_box_split(&cut, hist, box, &cut.boxes[cut.boxes_len])) {
+            break;
+        }
+        cut.boxes_len += 1;
+    }
+
+    for (usize i = 0; i < cut.boxes_len; i += 1) {
+        palette_box_average(&cut, hist, &cut.boxes[i], &out[i]);
+    }
+    *out_len = cut.boxes_len;
+    free(cut.bins);
+    return 0;
+}
+
+// Refines a median cut palette with Lloyd's algorithm. The points are the
+// non-empty histogram bins, weighted by population, which are far fewer than
+// the pixels and make each iteration independent of the image size.
+#define palette_kmeans_iterations_max 32
+// Iteration stops once no colour moves further than this along any channel.
+#define palette_kmeans_epsilon 0.5f
+// Fewer bins than this per thread are not worth a thread of their own.
+#define palette_kmeans_part_min 4096
+
+typedef struct Palette_Kmeans {
+    // Points and centroids are kept one channel per array, so that the
+    // distance loop vectorises.
+    f32 *r;
+    f32 *g;
+    f32 *b;
+    f32 *weights;
+    usize points_len;
+    f32 cr[palette_generated_max];
+    f32 cg[palette_generated_max];
+    f32 cb[palette_generated_max];
+    usize centroids_len;
+    // Worker threads are started once and wait on `start` for each round,
+    // the number of which `round` counts. The calling thread waits on `done`
+    // until no started part is `pending`.
+    Mutex mutex;
+    Cond start;
+    Cond done;
+    usize round;
+    usize pending;
+    bool stopped;
+} Palette_Kmeans;
+
+// Assigns a range of points and sums them per centroid.
+typedef struct Palette_Kmeans_Part {
+    Palette_Kmeans *kmeans;
+    usize beg;
+    usize end;
+    // Weighted channel sums, then total weight.
+    f64 sums[palette_generated_max][4];
+    Thread thread;
+    bool started;
+} Palette_Kmeans_Part;
+
+static void palette_kmeans_assign(void *arg) {
+    Palette_Kmeans_Part *part = arg;
+    const Palette_Kmeans *km = part->kmeans;
+    memset(part->sums, 0, sizeof(part->sums));
+
+    f32 dists[palette_generated_max];
+    for (usize i = part->beg; i < part->end; i += 1) {
+        f32 r = km->r[i], g = km->g[i], b = km->b[i];
+        for (usize j = 0; j < km->centroids_len; j += 1) {
+            f32 dr = km->cr[j] - r, dg = km->cg[j] - g, db = km->cb[j] - b;
+            dists[j] = dr * dr + dg * dg + db * db;
+        }
+        usize best = 0;
+        for (usize j = 1; j < km->centroids_len; j += 1) {
+            if (dists[j] < dists[best]) best = j;
+        }
+        f64 weight = km->weights[i];
+        part->sums[best][0] += weight * r;
+        part->sums[best][1] += weight * g;
+        part->sums[best][2] += weight * b;
+        part->sums[best][3] += weight;
+    }
+}
+
+static void palette_kmeans_worker(void *arg) {
+    Palette_Kmeans_Part *part = arg;
+    Palette_Kmeans *km = part->kmeans;
+    usize round = 0;
+    for (;;) {
+        mutex_lock(&km->mutex);
+        while (km->round == round && !km->stopped) {
+            cond_wait(&km->start, &km->mutex);
+        }
+        bool stopped = km->stopped;
+        round = km->round;
+        mutex_unlock(&km->mutex);
+        if (stopped) return;
+
+        palette_kmeans_assign(part);
+        mutex_lock(&km->mutex);
+        km->pending -= 1;
+        if (km->pending == 0) cond_signal(&km->done);
+        mutex_unlock(&km->mutex);
+    }
+}
+
+static error palette_kmeans(
+    const Palette_Hist *hist,
+    usize colours_len,
+    usize threads_len,
+    Rgb *out,
+    usize *out_len
+) {
+    try (palette_median_cut(hist, colours_len, out, out_len));
+    if (*out_len < 2) return 0;
+
+    Palette_Kmeans km = { .centroids_len = *out_len };
+    for (usize bin = 0; bin < palette_hist_len; bin += 1) {
+        if (hist->counts[bin] != 0) km.points_len += 1;
+    }
+    usize parts_len = km.points_len / palette_kmeans_part_min;
+    if (parts_len > threads_len) parts_len = threads_len;
+    if (parts_len == 0) parts_len = 1;
+
+    f32 *points = malloc(4 * km.points_len * sizeof(f32));
+    Palette_Kmeans_Part *parts = malloc(parts_len * sizeof(*parts));
+    if (points == NULL || parts == NULL) {
+        free(points);
+        free(parts);
+        return err("allocation failure");
+    }
+    km.r = points;
+    km.g = km.r + km.points_len;
+    km.b = km.g + km.points_len;
+    km.weights = km.b + km.points_len;
+
+    usize point_i = 0;
+    for (usize bin = 0; bin < palette_hist_len; bin += 1) {
+        u32 count = hist->counts[bin];
+        if (count == 0) continue;
+        km.r[point_i] = (f32)hist->sums[bin][0] / (f32)count;
+        km.g[point_i] = (f32)hist->sums[bin][1] / (f32)count;
+        km.b[point_i] = (f32)hist->sums[bin][2] / (f32)count;
+        km.weights[point_i] = (f32)count;
+        point_i += 1;
+    }
+    for (usize j = 0; j < km.centroids_len; j += 1) {
+        km.cr[j] = out[j].r;
+        km.cg[j] = out[j].g;
+        km.cb[j] = out[j].b;
+    }
+    mutex_init(&km.mutex);
+    cond_init(&km.start);
+    cond_init(&km.done);
+    for (usize p = 0; p < parts_len; p += 1) {
+        parts[p] = (Palette_Kmeans_Part){
+            .kmeans = &km,
+            .beg = km.points_len * p / parts_len,
+            .end = km.points_len * (p + 1) / parts_len,
+        };
+    }
+    // The first part runs on this thread, as does any part whose thread
+    // cannot be started.
+    usize started_len = 0;
+    for (usize p = 1; p < parts_len; p += 1) {
+        parts[p].started = thread_create(
+            &parts[p].thread, palette_kmeans_worker, &parts[p]
+        ) == 0;
+        if (parts[p].started) started_len += 1;
+    }
+
+    for (usize iter = 0; iter < palette_kmeans_iterations_max; iter += 1) {
+        mutex_lock(&km.mutex);
+        km.round += 1;
+        km.pending = started_len;
+        cond_broadcast(&km.start);
+        mutex_unlock(&km.mutex);
+        for (usize p = 0; p < parts_len; p += 1) {
+            if (!parts[p].started) palette_kmeans_assign(&parts[p]);
+        }
+        mutex_lock(&km.mutex);
+        while (km.pending != 0) cond_wait(&km.done, &km.mutex);
+        mutex_unlock(&km.mutex);
+
+        f32 moved = 0;
+        for (usize j = 0; j < km.centroids_len; j += 1) {
+            f64 sums[4] = { 0 };
+            for (usize p = 0; p < parts_len; p += 1) {
+                for (usize c = 0; c < 4; c += 1) sums[c] += parts[p].sums[j][c];
+            }
+            // A colour left without points keeps its place.
+            if (sums[3] == 0) continue;
+            f32 next[3] = {
+                (f32)(sums[0] / sums[3]),
+                (f32)(sums[1] / sums[3]),
+                (f32)(sums[2] / sums[3]),
+            };
+            f32 prev[3] = { km.cr[j], km.cg[j], km.cb[j] };
+            for (usize c = 0; c < 3; c += 1) {
+                f32 delta = next[c] > prev[c] ?
+                    next[c] - prev[c] : prev[c] - next[c];
+                if (delta > moved) moved = delta;
+            }
+            km.cr[j] = next[0];
+            km.cg[j] = next[1];
+            km.cb[j] = next[2];
+        }
+        if (moved < palette_kmeans_epsilon) break;
+    }
+    mutex_lock(&km.mutex);
+    km.stopped = true;
+    cond_broadcast(&km.start);
+    mutex_unlock(&km.mutex);
+    for (usize p = 1; p < parts_len; p += 1) {
+        if (parts[p].started) thread_join(&parts[p].thread);
+    }
+    mutex_deinit(&km.mutex);
+    cond_deinit(&km.start);
+    cond_deinit(&km.done);
+
+    for (usize j = 0; j < km.centroids_len; j += 1) {
+        out[j] = (Rgb){
+            .r = (u8)(km.cr[j] + 0.5f),
+            .g = (u8)(km.cg[j] + 0.5f),
+            .b = (u8)(km.cb[j] + 0.5f),
+        };
+    }
+    free(points);
+    free(parts);
+    return 0;
+}
+
+// Octree quantisation works in a single pass over the pixels in fixed memory,
+// rather than through a histogram: colours are inserted into a tree that
+// branches on one bit per channel at each level, and whenever the node pool
+// runs low the deepest branch is folded into a single leaf.
+#define palette_octree_depth 8
+#define palette_octree_nodes_max (1 << 14)
+
+typedef struct Palette_Octree_Node {
+    // Channel sums of the pixels in a leaf, and the number of pixels under
+    // any node.
+    u64 sums[3];
+    u64 count;
+    struct Palette_Octree_Node *children[8];
+    // Next branch on the same level, or next free node.
+    struct Palette_Octree_Node *next;
+    bool leaf;
+} Palette_Octree_Node;
+
+typedef struct Palette_Octree {
+    // Node pool; nodes freed by folding are reused before it grows.
+    Arena arena;
+    usize nodes_len;
+    Palette_Octree_Node *free;
+    usize free_len;
+    Palette_Octree_Node *root;
+    // Branches that may be folded, by level.
+    Palette_Octree_Node *branches[palette_octree_depth];
+    usize leaves_len;
+} Palette_Octree;
+
+static Palette_Octree_Node *palette_octree_node(Palette_Octree *tree) {
+    Palette_Octree_Node *node = tree->free;
+    if (node != NULL) {
+        tree->free = node->next;
+        tree->free_len -= 1;
+    } else {
+        // Cannot fail: inserts are preceded by folds that keep enough nodes.
+        arena_alloc(&tree->arena, sizeof(*node), &node);
+        tree->nodes_len += 1;
+    }
+    *node = (Palette_Octree_Node){ 0 };
+    return node;
+}
+
+// Merges the children of a branch on the deepest level into it: the most
+// recently added one while pixels are still being inserted, or with
+// `smallest`, the one covering the fewest pixels. Returns false if the tree is
+// a single leaf.
+static bool palette_octree_fold(Palette_Octree *tree, bool smallest) {
+    usize level = palette_octree_depth;
+    while (level > 0 && tree->branches[level - 1] == NULL) level -= 1;
+    if (level == 0) return false;
+
+    Palette_Octree_Node **link = &tree->branches[level - 1];
+    if (smallest) {
+        for (
+            Palette_Octree_Node **it = &(*link)->next;
+            *it != NULL;
+            it = &(*it)->next
+        ) {
+            if ((*it)->count < (*link)->count) link = it;
+        }
+    }
+    Palette_Octree_Node *node = *link;
+    *link = node->next;
+
+    // Children of the deepest branch are all leaves.
+    for (usize i = 0; i < 8; i += 1) {
+        Palette_Octree_Node *child = node->children[i];
+        if (child == NULL) continue;
+        for (usize c = 0; c < 3; c += 1) node->sums[c] += child->sums[c];
+        child->next = tree->free;
+        tree->free = child;
+        tree->free_len += 1;
+        tree->leaves_len -= 1;
+        node->children[i] = NULL;
+    }
+    node->leaf = true;
+    tree->leaves_len += 1;
+    return true;
+}
+
+static void palette_octree_add(Palette_Octree *tree, const u8 *pixel) {
+    // Enough nodes for a new path from the root to a leaf.
+    while (
+        tree->free_len + palette_octree_nodes_max - tree->nodes_len <
+            palette_octree_depth &&
+        palette_octree_fold(tree, false)
+    );
+
+    Palette_Octree_Node *node = tree->root;
+    for (usize level = 0; !node->leaf; level += 1) {
+        node->count += 1;
+        usize shift = palette_octree_depth - 1 - level;
+        usize i = (((pixel[0] >> shift) & 1) << 2) |
+            (((pixel[1] >> shift) & 1) << 1) |
+            ((pixel[2] >> shift) & 1);
+        if (node->children[i] == NULL) {
+            Palette_Octree_Node *child = palette_octree_node(tree);
+            if (level + 1 == palette_octree_depth) {
+                child->leaf = true;
+                tree->leaves_len += 1;
+            } else {
+                child->next = tree->branches[level + 1];
+                tree->branches[level + 1] = child;
+            }
+            node->children[i] = child;
+        }
+        node = node->children[i];
+    }
+    for (usize c = 0; c < 3; c += 1) node->sums[c] += pixel[c];
+    node->count += 1;
+}
+
+static void palette_octree_collect(
+    const Palette_Octree_Node *node,
+    Rgb *out,
+    usize *out_len
+) {
+    if (node->leaf) {
+        if (node->count == 0) return;
+        u64 half = node->count / 2;
+        out[(*out_len)++] = (Rgb){
+            .r = (u8)((node->sums[0] + half) / node->count),
+            .g = (u8)((node->sums[1] + half) / node->count),
+            .b = (u8)((node->sums[2] + half) / node->count),
+        };
+        return;
+    }
+    for (usize i = 0; i < 8; i += 1) {
+        if (node->children[i] != NULL) {
+            palette_octree_collect(node->children[i], out, out_len);
+        }
+    }
+}
+
+static error palette_octree(
+    const Palette_Spec *spec,
+    const u8 *data,
+    usize width,
+    usize rows,
+    Rgb *out,
+    usize *out_len
+) {
+    Palette_Octree tree = { 0 };
+    try (arena_init(
+        &tree.arena,
+        palette_octree_nodes_max *
+            (sizeof(Palette_Octree_Node) + ARENA_DEFAULT_ALIGNMENT)
+    ));
+    tree.root = palette_octree_node(&tree);
+    tree.branches[0] = tree.root;
+
+    for (usize y = 0; y < rows; y += spec->row_stride) {
+        const u8 *row = data + y * width * 3;
+        for (usize x = 0; x < width; x += 1) {
+            palette_octree_add(&tree, row + x * 3);
+        }
+    }
+    while (
+        tree.leaves_len > spec->colours_len &&
+        palette_octree_fold(&tree, true)
+    );
+
+    *out_len = 0;
+    palette_octree_collect(tree.root, out, out_len);
+    arena_deinit(&tree.arena);
+    return 0;
+}
+
+// Derives a palette of at most `spec->colours_len` colours from `rows` rows of
+// `width` RGB pixels in `data`, using up to `threads_len` threads. `out` must
+// hold palette_generated_max colours.
+static maybe_unused error palette_generate(
+    const Palette_Spec *spec,
+    const u8 *data,
+    usize width,
+    usize rows,
+    usize threads_len,
+    Rgb *out,
+    usize *out_len
+) {
+    if (spec->method == PALETTE_OCTREE) {
+        return palette_octree(spec, data, width, rows, out, out_len);
+    }
+
+    Palette_Hist *hist = calloc(1, sizeof(Palette_Hist));
+    if (hist == NULL) return err("allocation failure");
+    palette_hist_add(hist, data, width * rows * 3);
+
+    error e = 0;
+    switch (spec->method) {
+        case PALETTE_GIVEN: *out_len = 0; break;
+        case PALETTE_MEDIAN_CUT: {
+            e = palette_median_cut(hist, spec->colours_len, out, out_len);
+        } break;
+        case PALETTE_KMEANS: {
+            e = palette_kmeans(
+                hist, spec->colours_len, threads_len, out, out_len
+            );
+        } break;
+        case PALETTE_OCTREE: break;
+    }
+    free(hist);
+    return e;
+}
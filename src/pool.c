@@ -0,0 +1,293 @@
+// Work-stealing task pool. Every worker owns a deque: it pushes and pops its
+// own tasks at the tail (LIFO, so a task's continuation runs next on the same
+// core while its data is still in cache), and idle workers steal from the
+// head of other workers' deques (FIFO, so thieves take the oldest and usually
+// largest piece of outstanding work).
+
+typedef struct Pool Pool;
+typedef void (*Task_Fn)(Pool *pool, void *arg);
+typedef struct { Task_Fn fn; void *arg; } Task;
+
+typedef struct Pool_Worker {
+    Mutex mutex;
+    Task *ring;
+    usize cap;
+    usize head;
+    usize tail;
+    Thread thread;
+    Pool *pool;
+    usize id;
+} Pool_Worker;
+
+struct Pool {
+    Pool_Worker *workers;
+    usize workers_len;
+    Mutex mutex;
+    Cond wake;
+    Cond idle;
+    usize queued;
+    usize outstanding;
+    usize next_worker;
+    bool quit;
+};
+
+static thread_local_var Pool_Worker *pool_current_worker;
+
+static error pool_worker_push(Pool_Worker *worker, Task task) {
+    mutex_lock(&worker->mutex);
+    if (worker->tail - worker->head == worker->cap) {
+        usize new_cap = worker->cap == 0 ? 64 : worker->cap * 2;
+        Task *new_ring = malloc(new_cap * sizeof(Task));
+        if (new_ring == NULL) {
+            mutex_unlock(&worker->mutex);
+            return err("allocation failure");
+        }
+        for (usize i = worker->head; i < worker->tail; i += 1) {
+            new_ring[i - worker->head] = worker->ring[i % worker->cap];
+        }
+        free(worker->ring);
+        worker->ring = new_ring;
+        worker->tail -= worker->head;
+        worker->head = 0;
+        worker->cap = new_cap;
+    }
+    worker->ring[worker->tail % worker->cap] = task;
+    worker->tail += 1;
+    mutex_unlock(&worker->mutex);
+    return 0;
+}
+
+static bool pool_worker_pop(Pool_Worker *worker, Task *out) {
+    bool ok = false;
+    mutex_lock(&worker->mutex);
+    if (worker->tail != worker->head) {
+        worker->tail -= 1;
+        *out = worker->ring[worker->tail % worker->cap];
+        ok = true;
+    }
+    mutex_unlock(&worker->mutex);
+    return ok;
+}
+
+static bool pool_worker_steal(Pool_Worker *victim, Task *out) {
+    bool ok = false;
+    mutex_lock(&victim->mutex);
+    if (victim->tail != victim->head) {
+        *out = victim->ring[victim->head % victim->cap];
+        victim->head += 1;
+        ok = true;
+    }
+    mutex_unlock(&victim->mutex);
+    return ok;
+}
+
+static bool pool_take(Pool_Worker *worker, Task *out) {
+    if (pool_worker_pop(worker, out)) return true;
+    Pool *pool = worker->pool;
+    for (usize i = 1; i < pool->workers_len; i += 1) {
+        usize victim_i = (worker->id + i) % pool->workers_len;
+        if (pool_worker_steal(&pool->workers[victim_i], out)) return true;
+    }
+    return false;
+}
+
+static void pool_worker_loop(void *arg) {
+    Pool_Worker *worker = arg;
+    Pool *pool = worker->pool;
+    pool_current_worker = worker;
+
+    for (;;) {
+        Task task;
+        if (pool_take(worker, &task)) {
+            mutex_lock(&pool->mutex);
+            pool->queued -= 1;
+            mutex_unlock(&pool->mutex);
+
+            task.fn(pool, task.arg);
+
+            mutex_lock(&pool->mutex);
+            pool->outstanding -= 1;
+            if (pool->outstanding == 0) cond_broadcast(&pool->idle);
+            mutex_unlock(&pool->mutex);
+            continue;
+        }
+
+        mutex_lock(&pool->mutex);
+        while (pool->queued == 0 && !pool->quit) {
+            cond_wait(&pool->wake, &pool->mutex);
+        }
+        bool quit = pool->quit && pool->queued == 0;
+        mutex_unlock(&pool->mutex);
+        if (quit) return;
+    }
+}
+
+// Tasks submitted from inside a worker go to that worker's own deque; tasks
+// from outside the pool are dealt round-robin.
+static error pool_submit(Pool *pool, Task task) {
+    Pool_Worker *worker = pool_current_worker;
+    if (worker == NULL || worker->pool != pool) {
+        mutex_lock(&pool->mutex);
+        worker = &pool->workers[pool->next_worker];
+        pool->next_worker = (pool->next_worker + 1) % pool->workers_len;
+        mutex_unlock(&pool->mutex);
+    }
+    try (pool_worker_push(worker, task));
+
+    mutex_lock(&pool->mutex);
+    pool->queued += 1;
+    pool->outstanding += 1;
+    cond_signal(&pool->wake);
+    mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+static void pool_wait(Pool *pool) {
+    mutex_lock(&pool->mutex);
+    while (pool->outstanding != 0) cond_wait(&pool->idle, &pool->mutex);
+    mutex_unlock(&pool->mutex);
+}
+
+static void pool_deinit(Pool *pool) {
+    mutex_lock(&pool->mutex);
+    pool->quit = true;
+    cond_broadcast(&pool->wake);
+    mutex_unlock(&pool->mutex);
+
+    // Idle workers still try to steal from each other until they observe
+    // `quit`, so nothing can be torn down before every thread has exited.
+    for (usize i = 0; i < pool->workers_len; i += 1) {
+        Pool_Worker *worker = &pool->workers[i];
+        if (worker->pool != NULL) thread_join(&worker->thread);
+    }
+    for (usize i = 0; i < pool->workers_len; i += 1) {
+        free(pool->workers[i].ring);
+        mutex_deinit(&pool->workers[i].mutex);
+    }
+    free(pool->workers);
+    mutex_deinit(&pool->mutex);
+    cond_deinit(&pool->wake);
+    cond_deinit(&pool->idle);
+    *pool = (Pool){ 0 };
+}
+
+static error pool_init(Pool *pool, usize workers_len) {
+    *pool = (Pool){ .workers_len = workers_len == 0 ? 1 : workers_len };
+    mutex_init(&pool->mutex);
+    cond_init(&pool->wake);
+    cond_init(&pool->idle);
+
+    pool->workers = calloc(pool->workers_len, sizeof(Pool_Worker));
+    if (pool->workers == NULL) return err("allocation failure");
+    for (usize i = 0; i < pool->workers_len; i += 1) {
+        mutex_init(&pool->workers[i].mutex);
+        pool->workers[i].id = i;
+    }
+
+    for (usize i = 0; i < pool->workers_len; i += 1) {
+        Pool_Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        if (thread_create(&worker->thread, pool_worker_loop, worker) != 0) {
+            worker->pool = NULL;
+            pool_deinit(pool);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A pool task waiting in budget_try_acquire for its bytes.
+typedef struct Budget_Waiter {
+    struct Budget_Waiter *next;
+    usize bytes;
+    Pool *pool;
+    Task task;
+} Budget_Waiter;
+
+// Caps the bytes held by in-flight work. A single request larger than the
+// whole budget is still admitted once nothing else is in flight, so an
+// oversized image degrades to serial processing instead of deadlocking.
+typedef struct Budget {
+    Mutex mutex;
+    Cond cond;
+    usize cap;
+    usize used;
+    // Oldest first; the first never fits while it waits.
+    Budget_Waiter *waiting;
+    Budget_Waiter *waiting_last;
+} Budget;
+
+static void budget_init(Budget *budget, usize cap) {
+    *budget = (Budget){ .cap = cap };
+    mutex_init(&budget->mutex);
+    cond_init(&budget->cond);
+}
+
+static void budget_deinit(Budget *budget) {
+    mutex_deinit(&budget->mutex);
+    cond_deinit(&budget->cond);
+}
+
+static bool budget_fits(Budget *budget, usize bytes) {
+    return budget->used == 0 || budget->used + bytes <= budget->cap;
+}
+
+// Blocks until the bytes fit. Not for pool workers; see budget_try_acquire.
+static void budget_acquire(Budget *budget, usize bytes) {
+    mutex_lock(&budget->mutex);
+    while (!budget_fits(budget, bytes)) {
+        cond_wait(&budget->cond, &budget->mutex);
+    }
+    budget->used += bytes;
+    mutex_unlock(&budget->mutex);
+}
+
+// A pool worker must not sleep on the budget, as the tasks that would release
+// it may be queued behind it in its own deque. Takes the waiter's bytes and
+// returns true if they fit. Otherwise the waiter is queued and false is
+// returned; budget_release takes the bytes on its behalf once they fit, and
+// submits its task.
+static bool budget_try_acquire(Budget *budget, Budget_Waiter *waiter) {
+    mutex_lock(&budget->mutex);
+    // Later requests do not overtake earlier ones, so large ones still get in.
+    bool fits = budget->waiting == NULL && budget_fits(budget, waiter->bytes);
+    if (fits) {
+        budget->used += waiter->bytes;
+    } else {
+        waiter->next = NULL;
+        if (budget->waiting == NULL) budget->waiting = waiter;
+        else budget->waiting_last->next = waiter;
+        budget->waiting_last = waiter;
+    }
+    mutex_unlock(&budget->mutex);
+    return fits;
+}
+
+static void budget_release(Budget *budget, usize bytes) {
+    Budget_Waiter *admitted = NULL;
+    Budget_Waiter **admitted_last = &admitted;
+    mutex_lock(&budget->mutex);
+    budget->used -= bytes;
+    while (budget->waiting != NULL &&
+        budget_fits(budget, budget->waiting->bytes)
+    ) {
+        Budget_Waiter *waiter = budget->waiting;
+        budget->waiting = waiter->next;
+        budget->used += waiter->bytes;
+        *admitted_last = waiter;
+        admitted_last = &waiter->next;
+    }
+    *admitted_last = NULL;
+    cond_broadcast(&budget->cond);
+    mutex_unlock(&budget->mutex);
+
+    while (admitted != NULL) {
+        // The task may free its waiter as soon as it is submitted.
+        Budget_Waiter *waiter = admitted;
+        admitted = waiter->next;
+        Task task = waiter->task;
+        if (pool_submit(waiter->pool, task) != 0) {
+            task.fn(waiter->pool, task.arg);
+        }
+    }
+}
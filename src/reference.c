@@ -0,0 +1,150 @@
+// Palettes extracted from a reference image (--palette-from), to match the
+// colours of existing artwork. With --cache-dir, the extracted palette is kept
+// under a hash of the reference file, so later runs skip decoding it.
+
+// The reference is sampled down to about this many pixels, which is plenty
+// to find its main colours.
+#define reference_pixels_max (1 << 20)
+
+// Splits `<file>:<n>` at its last colon, so that paths may contain colons.
+static error reference_spec_from_str8(
+    Arena *arena,
+    Str8 s,
+    Str8 *path,
+    usize *colours_len
+) {
+    usize colon = s.len;
+    while (colon > 0 && s.ptr[colon - 1] != ':') colon -= 1;
+    if (colon <= 1) {
+        return errf("expected <file>:<colours>, got '%.*s'", str8_fmt(s));
+    }
+    // Copied so that the path is terminated for fopen().
+    *path = str8_from_cstr(cstr_from_str8(arena, str8_range(s, 0, colon - 1)));
+    try (usize_from_str8(str8_range(s, colon, s.len), colours_len));
+    if (*colours_len < 2 || *colours_len > palette_generated_max) {
+        return errf(
+            "expected between 2 and %d colours in '%.*s'",
+            palette_generated_max, str8_fmt(s)
+        );
+    }
+    return 0;
+}
+
+// Generates the palette from every `step`th pixel of every `step`th row.
+static error reference_extract(
+    Str8 path,
+    Str8 file,
+    usize colours_len,
+    Rgb *out,
+    usize *out_len
+) {
+    int width, height, channels;
+    u8 *pixels = stbi_load_from_memory(
+        file.ptr, (int)file.len, &width, &height, &channels, 3
+    );
+    if (pixels == NULL) return errf(
+        "error loading reference image '%.*s':\n%s",
+        str8_fmt(path), stbi_failure_reason()
+    );
+
+    usize step = 1;
+    while (
+        ((usize)width / step) * ((usize)height / step) > reference_pixels_max
+    ) {
+        step += 1;
+    }
+    usize sample_width = ((usize)width + step - 1) / step;
+    usize sample_height = ((usize)height + step - 1) / step;
+    u8 *sample = pixels;
+    if (step > 1) {
+        sample = malloc(sample_width * sample_height * 3);
+        if (sample == NULL) {
+            stbi_image_free(pixels);
+            return err("allocation failure");
+        }
+        u8 *dst = sample;
+        for (usize y = 0; y < (usize)height; y += step) {
+            const u8 *row = pixels + y * (usize)width * 3;
+            for (usize x = 0; x < (usize)width; x += step) {
+                memcpy(dst, row + x * 3, 3);
+                dst += 3;
+            }
+        }
+    }
+
+    Palette_Spec spec = {
+        .method = PALETTE_KMEANS,
+        .colours_len = colours_len,
+        .row_stride = 1,
+    };
+    error e = palette_generate(
+        &spec, sample, sample_width, sample_height, cpu_count(), out, out_len
+    );
+    if (sample != pixels) free(sample);
+    stbi_image_free(pixels);
+    if (e == 0 && *out_len < 2) {
+        e = errf(
+            "reference image '%.*s' has too few colours for a palette",
+            str8_fmt(path)
+        );
+    }
+    return e;
+}
+
+// Resolves a `<file>:<n>` argument to a palette allocated from `arena`.
+// `cache` may be NULL.
+static error reference_palette(
+    Arena *arena,
+    Cache *cache,
+    Str8 arg,
+    Palette *out
+) {
+    Str8 path; usize colours_len;
+    try (reference_spec_from_str8(arena, arg, &path, &colours_len));
+
+    FILE *file = NULL;
+    try (file_open(path, "rb", &file));
+    usize contents_len = 0;
+    error e = file_len(file, &contents_len);
+    Arena file_arena = { 0 };
+    if (e == 0) e = arena_init(
+        &file_arena, contents_len + 2 * ARENA_DEFAULT_ALIGNMENT
+    );
+    Str8 contents = { 0 };
+    if (e == 0) e = file_read_from(&file_arena, file, &contents);
+    fclose(file);
+
+    Rgb colours[palette_generated_max];
+    usize len = 0;
+    u64 key = 0;
+    bool cached = false;
+    if (e == 0 && cache != NULL) {
+        u64 params[2] = { PALETTE_KMEANS, colours_len };
+        key = hash64(contents.ptr, contents.len, cache->seed);
+        key = hash64(params, sizeof(params), key);
+
+        Str8 entry;
+        cached = cache_load(cache, key, str8("pal"), arena, &entry) &&
+            entry.len >= 2 * sizeof(Rgb) &&
+            entry.len <= sizeof(colours) &&
+            entry.len % sizeof(Rgb) == 0;
+        if (cached) {
+            len = entry.len / sizeof(Rgb);
+            memcpy(colours, entry.ptr, entry.len);
+        }
+    }
+    if (e == 0 && !cached) {
+        e = reference_extract(path, contents, colours_len, colours, &len);
+        if (e == 0 && cache != NULL) {
+            Str8 entry = { .ptr = (u8 *)colours, .len = len * sizeof(Rgb) };
+            cache_save(cache, key, str8("pal"), entry);
+        }
+    }
+    arena_deinit(&file_arena);
+    if (e != 0) return e;
+
+    out->len = len;
+    try (arena_alloc(arena, len * sizeof(Rgb), &out->ptr));
+    memcpy(out->ptr, colours, len * sizeof(Rgb));
+    return 0;
+}
@@ -0,0 +1,328 @@
+// Nearest palette colour search. Every strategy finds the same colour, the
+// closest by L1 distance with ties going to the lowest index, but which one is
+// fastest depends on the size of the palette. A dispatch table picks one per
+// size; `imgclr --calibrate` measures them to fill it in for this machine.
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define SEARCH_SSE2
+#endif
+
+typedef enum Search_Kind {
+    // Distance to each colour in turn.
+    SEARCH_SCALAR,
+    // Distances to eight colours at a time.
+    SEARCH_SIMD,
+    // SEARCH_SIMD, remembered per 24-bit colour in an image memo.
+    SEARCH_LUT,
+    // k-d tree over the palette, skipping colours that cannot be closer.
+    SEARCH_TREE,
+    // Two-colour palettes only: the sign of a sum of per-channel differences.
+    SEARCH_PAIR,
+    // Palettes of up to 16 colours: the scalar loop unrolled for the size
+    // class, 2, 4, 8 or 16, with the distances compared without branches.
+    SEARCH_FIXED,
+    SEARCH_KINDS_LEN,
+} Search_Kind;
+
+static maybe_unused const char *search_kind_names[SEARCH_KINDS_LEN] = {
+    "scalar", "simd", "lut", "tree", "pair", "fixed",
+};
+
+// Larger palettes always use SEARCH_SCALAR.
+#define search_palette_max 256
+#define search_fixed_max 16
+#define search_lanes 8
+// One entry per palette size class: 1, 2, 3-4, 5-8, ..., 129-256 colours.
+#define search_table_len 9
+
+// Defaults from `imgclr-bench --search` on photo-like pixels. A memo pays for
+// itself on images of few distinct colours, but not on photographs. Up to four
+// colours, SEARCH_FIXED matches SEARCH_SIMD on photographs and is well ahead
+// on other pixels.
+static Search_Kind search_table[search_table_len] = {
+    SEARCH_SCALAR, SEARCH_PAIR, SEARCH_FIXED, SEARCH_SIMD, SEARCH_SIMD,
+    SEARCH_SIMD, SEARCH_SIMD, SEARCH_SIMD, SEARCH_SIMD,
+};
+
+// Distances to padding colours exceed any real distance, so they never win.
+#define search_pad 1024
+
+typedef struct Search {
+    Search_Kind kind;
+    Palette palette;
+    // The palette's channels, padded to a multiple of search_lanes.
+    usize lanes_len;
+    i16 channels[3][search_palette_max];
+    // Palette indices in k-d tree order. The node of a range is its middle
+    // element, which splits the rest on `tree_axis` of that element.
+    u8 tree_index[search_palette_max];
+    u8 tree_axis[search_palette_max];
+    // How much closer each channel value is to the second colour than to the
+    // first, for SEARCH_PAIR.
+    i16 pair[3][256];
+} Search;
+
+static usize search_table_index(usize palette_len) {
+    usize i = 0;
+    while (i + 1 < search_table_len && ((usize)1 << i) < palette_len) i += 1;
+    return i;
+}
+
+static Search_Kind search_kind_for(usize palette_len) {
+    if (palette_len > search_palette_max) return SEARCH_SCALAR;
+    return search_table[search_table_index(palette_len)];
+}
+
+static bool search_kind_supports(Search_Kind kind, usize palette_len) {
+    if (palette_len > search_palette_max) return kind == SEARCH_SCALAR;
+    if (kind == SEARCH_PAIR) return palette_len == 2;
+    if (kind == SEARCH_FIXED) return palette_len <= search_fixed_max;
+    return true;
+}
+
+static u16 search_distance(const Search *search, usize j, const i16 q[3]) {
+    return (u16)(
+        abs(q[0] - search->channels[0][j]) +
+        abs(q[1] - search->channels[1][j]) +
+        abs(q[2] - search->channels[2][j])
+    );
+}
+
+// Sorts [beg, end) by the widest channel, so that the middle splits it.
+static void search_tree_build(Search *search, usize beg, usize end) {
+    if (end - beg < 2) {
+        if (end > beg) search->tree_axis[beg] = 0;
+        return;
+    }
+    i16 lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+    for (usize i = beg; i < end; i += 1) {
+        for (usize c = 0; c < 3; c += 1) {
+            i16 v = search->channels[c][search->tree_index[i]];
+            if (v < lo[c]) lo[c] = v;
+            if (v > hi[c]) hi[c] = v;
+        }
+    }
+    u8 axis = 0;
+    for (u8 c = 1; c < 3; c += 1) {
+        if (hi[c] - lo[c] > hi[axis] - lo[axis]) axis = c;
+    }
+    const i16 *values = search->channels[axis];
+    for (usize i = beg + 1; i < end; i += 1) {
+        u8 index = search->tree_index[i];
+        usize j = i;
+        while (j > beg && values[search->tree_index[j - 1]] > values[index]) {
+            search->tree_index[j] = search->tree_index[j - 1];
+            j -= 1;
+        }
+        search->tree_index[j] = index;
+    }
+    usize mid = beg + (end - beg) / 2;
+    search->tree_axis[mid] = axis;
+    search_tree_build(search, beg, mid);
+    search_tree_build(search, mid + 1, end);
+}
+
+static void search_init(Search *search, Palette palette, Search_Kind kind) {
+    search->kind = search_kind_supports(kind, palette.len) ? kind :
+        SEARCH_SCALAR;
+    search->palette = palette;
+    if (search->kind == SEARCH_SCALAR) return;
+    if (search->kind == SEARCH_PAIR) {
+        Rgb first = palette.ptr[0], second = palette.ptr[1];
+        i16 a[3] = { first.r, first.g, first.b };
+        i16 b[3] = { second.r, second.g, second.b };
+        for (i16 v = 0; v < 256; v += 1) {
+            for (usize c = 0; c < 3; c += 1) {
+                search->pair[c][v] = (i16)(abs(v - a[c]) - abs(v - b[c]));
+            }
+        }
+        return;
+    }
+
+    search->lanes_len = (palette.len + search_lanes - 1) / search_lanes *
+        search_lanes;
+    for (usize j = 0; j < search->lanes_len; j += 1) {
+        bool pad = j >= palette.len;
+        search->channels[0][j] = pad ? search_pad : palette.ptr[j].r;
+        search->channels[1][j] = pad ? search_pad : palette.ptr[j].g;
+        search->channels[2][j] = pad ? search_pad : palette.ptr[j].b;
+    }
+    if (search->kind == SEARCH_TREE) {
+        for (usize j = 0; j < palette.len; j += 1) {
+            search->tree_index[j] = (u8)j;
+        }
+        search_tree_build(search, 0, palette.len);
+    }
+}
+
+static usize search_scalar(const Search *search, const u8 *rgb) {
+    Palette palette = search->palette;
+    usize best_match = 0;
+    u16 min_diff = 999;
+    for (usize j = 0; j < palette.len; j += 1) {
+        u16 diff_total = (u16)abs(rgb[0] - palette.ptr[j].r) +
+                         (u16)abs(rgb[1] - palette.ptr[j].g) +
+                         (u16)abs(rgb[2] - palette.ptr[j].b);
+        if (diff_total < min_diff) {
+            min_diff = diff_total;
+            best_match = j;
+        }
+    }
+    return best_match;
+}
+
+// Finds the smallest distance first, then the first colour at that distance.
+static usize search_simd(const Search *search, const u8 *rgb) {
+    i16 dists[search_palette_max];
+    #ifdef SEARCH_SSE2
+        __m128i q[3] = {
+            _mm_set1_epi16(rgb[0]), _mm_set1_epi16(rgb[1]),
+            _mm_set1_epi16(rgb[2]),
+        };
+        __m128i min = _mm_set1_epi16(0x7fff);
+        for (usize j = 0; j < search->lanes_len; j += search_lanes) {
+            __m128i dist = _mm_setzero_si128();
+            for (usize c = 0; c < 3; c += 1) {
+                __m128i p = _mm_loadu_si128(
+                    (const __m128i *)&search->channels[c][j]
+                );
+                dist = _mm_add_epi16(dist, _mm_sub_epi16(
+                    _mm_max_epi16(q[c], p), _mm_min_epi16(q[c], p)
+                ));
+            }
+            _mm_storeu_si128((__m128i *)&dists[j], dist);
+            min = _mm_min_epi16(min, dist);
+        }
+        min = _mm_min_epi16(min, _mm_srli_si128(min, 8));
+        min = _mm_min_epi16(min, _mm_srli_si128(min, 4));
+        min = _mm_min_epi16(min, _mm_srli_si128(min, 2));
+        min = _mm_set1_epi16((i16)_mm_cvtsi128_si32(min));
+        for (usize j = 0;; j += search_lanes) {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(
+                _mm_loadu_si128((const __m128i *)&dists[j]), min
+            ));
+            if (mask == 0) continue;
+            while ((mask & 1) == 0) {
+                mask >>= 2;
+                j += 1;
+            }
+            return j;
+        }
+    #else
+        // Plain loops over the channels that compilers vectorise.
+        for (usize j = 0; j < search->lanes_len; j += 1) {
+            i16 dr = (i16)(rgb[0] - search->channels[0][j]);
+            i16 dg = (i16)(rgb[1] - search->channels[1][j]);
+            i16 db = (i16)(rgb[2] - search->channels[2][j]);
+            dists[j] = (i16)((dr < 0 ? -dr : dr) + (dg < 0 ? -dg : dg) +
+                (db < 0 ? -db : db));
+        }
+        i16 min = 0x7fff;
+        for (usize j = 0; j < search->lanes_len; j += 1) {
+            if (dists[j] < min) min = dists[j];
+        }
+        usize j = 0;
+        while (dists[j] != min) j += 1;
+        return j;
+    #endif // SEARCH_SSE2
+}
+
+static void search_tree_visit(
+    const Search *search,
+    const i16 q[3],
+    usize beg,
+    usize end,
+    u16 *best_diff,
+    usize *best_match
+) {
+    while (beg < end) {
+        usize mid = beg + (end - beg) / 2;
+        usize j = search->tree_index[mid];
+        u16 diff = search_distance(search, j, q);
+        if (diff < *best_diff || (diff == *best_diff && j < *best_match)) {
+            *best_diff = diff;
+            *best_match = j;
+        }
+
+        // Colours across the split are at least `gap` away, but may still tie
+        // with a higher index than theirs.
+        u8 axis = search->tree_axis[mid];
+        i16 offset = q[axis] - search->channels[axis][j];
+        u16 gap = (u16)(offset < 0 ? -offset : offset);
+        if (offset < 0) {
+            search_tree_visit(search, q, beg, mid, best_diff, best_match);
+            if (gap > *best_diff) return;
+            beg = mid + 1;
+        } else {
+            search_tree_visit(search, q, mid + 1, end, best_diff, best_match);
+            if (gap > *best_diff) return;
+            end = mid;
+        }
+    }
+}
+
+static usize search_tree(const Search *search, const u8 *rgb) {
+    i16 q[3] = { rgb[0], rgb[1], rgb[2] };
+    u16 best_diff = 0xffff;
+    usize best_match = 0;
+    search_tree_visit(
+        search, q, 0, search->palette.len, &best_diff, &best_match
+    );
+    return best_match;
+}
+
+// L1 distance is not linear, but it is separable: the second colour is closer
+// exactly when the per-channel differences add up to more than zero. A tie
+// keeps the first.
+static usize search_pair(const Search *search, const u8 *rgb) {
+    return search->pair[0][rgb[0]] + search->pair[1][rgb[1]] +
+        search->pair[2][rgb[2]] > 0;
+}
+
+// One colour of SEARCH_FIXED. Each distance is keyed with its index in the
+// low bits, so that the smallest key is the first of the closest colours.
+// Padding colours are never closer, so each search may cover its whole size
+// class.
+#define SEARCH_FIXED_STEP(j) { \
+    u32 key = (u32)( \
+        abs(rgb[0] - search->channels[0][j]) + \
+        abs(rgb[1] - search->channels[1][j]) + \
+        abs(rgb[2] - search->channels[2][j]) \
+    ) << 4 | (j); \
+    min_key = key < min_key ? key : min_key; \
+}
+#define SEARCH_FIXED_2(j) SEARCH_FIXED_STEP(j) SEARCH_FIXED_STEP((j) + 1)
+#define SEARCH_FIXED_4(j) SEARCH_FIXED_2(j) SEARCH_FIXED_2((j) + 2)
+#define SEARCH_FIXED_8(j) SEARCH_FIXED_4(j) SEARCH_FIXED_4((j) + 4)
+#define SEARCH_FIXED_16(j) SEARCH_FIXED_8(j) SEARCH_FIXED_8((j) + 8)
+
+#define SEARCH_FIXED(n) \
+    static usize search_fixed_##n(const Search *search, const u8 *rgb) { \
+        u32 min_key = 0xffffffff; \
+        SEARCH_FIXED_##n(0) \
+        return min_key & 15; \
+    }
+SEARCH_FIXED(2)
+SEARCH_FIXED(4)
+SEARCH_FIXED(8)
+SEARCH_FIXED(16)
+
+static usize search_fixed(const Search *search, const u8 *rgb) {
+    usize len = search->palette.len;
+    if (len <= 2) return search_fixed_2(search, rgb);
+    if (len <= 4) return search_fixed_4(search, rgb);
+    if (len <= 8) return search_fixed_8(search, rgb);
+    return search_fixed_16(search, rgb);
+}
+
+static usize search_nearest(const Search *search, const u8 *rgb) {
+    switch (search->kind) {
+        case SEARCH_PAIR: return search_pair(search, rgb);
+        case SEARCH_FIXED: return search_fixed(search, rgb);
+        case SEARCH_SIMD:
+        case SEARCH_LUT: return search_simd(search, rgb);
+        case SEARCH_TREE: return search_tree(search, rgb);
+        default: return search_scalar(search, rgb);
+    }
+}
@@ -0,0 +1,625 @@
+// Local daemon mode. A long-running server keeps its worker pool and parsed
+// palettes warm and processes requests sent over a Unix domain socket, so
+// callers that run imgclr many times only pay for the image work itself.
+//
+// Every frame is a little-endian u32 length followed by that many bytes.
+//
+// Request:  [arguments] [image]
+//     arguments: NUL-separated `<input> <output>` followed by any of
+//         --palette, --dither, --invert and --ext. An input of '-' means the
+//         image frame holds the encoded input; otherwise the image frame is
+//         empty and the input is read from the server's filesystem. An output
+//         of '-' means the encoded result is returned in the response, in the
+//         format given by --ext (default: png).
+// Response: [status] [image]
+//     status: one byte, zero on success, followed by the message text.
+//
+// A connection may carry any number of requests, one after another. Each
+// connection has a thread of its own that waits for its requests, and hands
+// the image work to the shared pool.
+
+#define serve_frame_max (1u << 30)
+#define serve_cache_cap 64
+
+#ifndef _WIN32
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct Serve_Cache_Entry {
+    Str8 key;
+    Job_Options options;
+} Serve_Cache_Entry;
+
+typedef struct Serve {
+    Batch batch;
+    Mutex mutex;
+    // Parsed options, keyed by the arguments that produced them. Entries
+    // live in `cache_arena` for the lifetime of the server.
+    Arena cache_arena;
+    Serve_Cache_Entry cache[serve_cache_cap];
+    usize cache_len;
+    // Open connections, so they can be shut down when the server stops, and
+    // finished ones, until their threads are joined.
+    struct Serve_Conn **conns;
+    usize conns_len;
+    usize conns_cap;
+} Serve;
+
+typedef struct Serve_Conn {
+    Serve *serve;
+    int fd;
+    Thread thread;
+    bool finished;
+} Serve_Conn;
+
+static volatile sig_atomic_t serve_stop;
+// Written to by the signal handler, to wake the accept loop whichever thread
+// the signal is delivered to.
+static int serve_signal_pipe[2] = { -1, -1 };
+
+static void serve_handle_signal(int signal) {
+    (void)signal;
+    serve_stop = 1;
+    int saved_errno = errno;
+    ssize_t n = write(serve_signal_pipe[1], "", 1);
+    (void)n;
+    errno = saved_errno;
+}
+
+static error fd_read_full(int fd, void *buf, usize len) {
+    u8 *ptr = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, ptr, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static error fd_write_full(int fd, const void *buf, usize len) {
+    const u8 *ptr = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, ptr, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// On success, `out->ptr` is allocated with malloc and NUL-terminated.
+static error frame_read(int fd, Str8 *out) {
+    u8 header[4];
+    try (fd_read_full(fd, header, sizeof(header)));
+    usize len = (usize)header[0] | (usize)header[1] << 8 |
+        (usize)header[2] << 16 | (usize)header[3] << 24;
+    if (len > serve_frame_max) return err("frame too large");
+
+    u8 *ptr = malloc(len + 1);
+    if (ptr == NULL) return err("allocation failure");
+    if (fd_read_full(fd, ptr, len) != 0) {
+        free(ptr);
+        return 1;
+    }
+    ptr[len] = '\0';
+    *out = (Str8){ .ptr = ptr, .len = len };
+    return 0;
+}
+
+static error frame_write_parts(int fd, Str8 head, Str8 body) {
+    usize len = head.len + body.len;
+    if (len > serve_frame_max) return err("frame too large");
+    u8 header[4] = { len & 0xff, len >> 8 & 0xff, len >> 16 & 0xff, len >> 24 };
+    try (fd_write_full(fd, header, sizeof(header)));
+    try (fd_write_full(fd, head.ptr, head.len));
+    return fd_write_full(fd, body.ptr, body.len);
+}
+
+static error frame_write(int fd, Str8 frame) {
+    return frame_write_parts(fd, (Str8){ 0 }, frame);
+}
+
+static error serve_socket_address(Str8 path, struct sockaddr_un *out) {
+    *out = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    if (path.len >= sizeof(out->sun_path)) return errf(
+        "socket path '%.*s' is too long", str8_fmt(path)
+    );
+    memcpy(out->sun_path, path.ptr, path.len);
+    return 0;
+}
+
+// Looks up or parses the options for one request. Parsed options are copied
+// into the cache arena, so later requests with the same palette reuse them.
+static error serve_options(
+    Serve *serve,
+    Arena *arena,
+    char **argv,
+    Args_Flag *palette_flag,
+    Args_Flag *dither_flag,
+    Args_Flag *invert_flag,
+    const Job_Options **out
+) {
+    int palette_beg_i = palette_flag->multi_pos.beg_i;
+    int palette_end_i = palette_flag->multi_pos.end_i;
+    Str8 dither = dither_flag->single_pos;
+
+    usize key_len = dither.len + 2;
+    for (int i = palette_beg_i; i < palette_end_i; i += 1) {
+        key_len += strlen(argv[i]) + 1;
+    }
+
+    Str8 key = { 0 };
+    try (arena_alloc(arena, key_len, &key.ptr));
+    for (int i = palette_beg_i; i < palette_end_i; i += 1) {
+        usize len = strlen(argv[i]);
+        memcpy(key.ptr + key.len, argv[i], len);
+        key.ptr[key.len + len] = ' ';
+        key.len += len + 1;
+    }
+    memcpy(key.ptr + key.len, dither.ptr, dither.len);
+    key.len += dither.len;
+    key.ptr[key.len++] = ' ';
+    key.ptr[key.len++] = invert_flag->is_present ? 'i' : '-';
+
+    mutex_lock(&serve->mutex);
+    for (usize i = 0; i < serve->cache_len; i += 1) {
+        if (!str8_eql(serve->cache[i].key, key)) continue;
+        *out = &serve->cache[i].options;
+        mutex_unlock(&serve->mutex);
+        return 0;
+    }
+    mutex_unlock(&serve->mutex);
+
+    Job_Options *options = NULL;
+    try (arena_alloc(arena, sizeof(Job_Options), &options));
+    try (job_options_from_flags(
+        arena, argv, palette_flag, dither_flag, invert_flag, options
+    ));
+    *out = options;
+
+    mutex_lock(&serve->mutex);
+    Arena *cache_arena = &serve->cache_arena;
+    usize palette_size = options->palette.len * sizeof(Rgb);
+    Serve_Cache_Entry entry = {
+        .key = { .len = key.len },
+        .options = *options,
+    };
+    if (serve->cache_len < serve_cache_cap &&
+        arena_alloc(cache_arena, key.len, &entry.key.ptr) == 0 &&
+        arena_alloc(cache_arena, palette_size, &entry.options.palette.ptr) == 0
+    ) {
+        memcpy(entry.key.ptr, key.ptr, key.len);
+        memcpy(entry.options.palette.ptr, options->palette.ptr, palette_size);
+        serve->cache[serve->cache_len] = entry;
+        *out = &serve->cache[serve->cache_len].options;
+        serve->cache_len += 1;
+    }
+    mutex_unlock(&serve->mutex);
+    return 0;
+}
+
+static error serve_process(
+    Serve *serve,
+    Str8 args,
+    Str8 image,
+    Image_Buffer *result,
+    FILE *messages
+) {
+    Arena arena = { 0 };
+    try (arena_init(&arena, args.len + 64 * 1024));
+
+    usize argc = 1;
+    for (usize i = 0; i < args.len; i += 1) argc += args.ptr[i] == '\0';
+    char **argv = NULL;
+    error e = arena_alloc(&arena, (argc + 2) * sizeof(char *), &argv);
+    if (e != 0) goto done;
+    argv[0] = "imgclr";
+    argc = 1;
+    for (usize i = 0; i < args.len; ) {
+        argv[argc++] = (char *)args.ptr + i;
+        while (i < args.len && args.ptr[i] != '\0') i += 1;
+        i += 1;
+    }
+    argv[argc] = NULL;
+
+    Args_Flag invert_flag = { .name = str8("invert") };
+    Args_Flag dither_flag = {
+        .name = str8("dither"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag palette_flag = {
+        .name = str8("palette"),
+        .kind = args_kind_multi_pos,
+    };
+    Args_Flag ext_flag = {
+        .name = str8("ext"),
+        .kind = args_kind_single_pos,
+    };
+    Args_Flag *flags[] = {
+        &dither_flag,
+        &invert_flag,
+        &palette_flag,
+        &ext_flag,
+    };
+    Args_Desc args_desc = {
+        .exe_kind = args_kind_multi_pos,
+        .flags = slice(flags),
+    };
+    e = args_parse((int)argc, argv, &args_desc);
+    if (e != 0) goto done;
+    if (args_desc.multi_pos.end_i - args_desc.multi_pos.beg_i != 2) {
+        e = err("expected input and output paths as positional arguments");
+        goto done;
+    }
+
+    Job job = {
+        .quiet = true,
+        .infile_path = str8_from_cstr(argv[args_desc.multi_pos.beg_i]),
+        .outfile_path = str8_from_cstr(argv[args_desc.multi_pos.beg_i + 1]),
+    };
+    e = serve_options(
+        serve, &arena, argv, &palette_flag, &dither_flag, &invert_flag,
+        &job.options
+    );
+    if (e != 0) goto done;
+
+    if (str8_eql(job.infile_path, str8("-"))) job.infile = image;
+    if (str8_eql(job.outfile_path, str8("-"))) job.outfile_buffer = result;
+    if (ext_flag.is_present) {
+        e = format_from_ext(ext_flag.single_pos, &job.outfile_format);
+    } else if (job.outfile_buffer != NULL) {
+        job.outfile_format = FORMAT_PNG;
+    } else {
+        e = format_from_str(job.outfile_path, &job.outfile_format);
+    }
+    if (e != 0) goto done;
+
+    // The connection's thread waits while the pool does the work.
+    Job_Done job_done;
+    job_done_init(&job_done);
+    job.done = &job_done;
+    job.err_file = messages;
+    batch_submit(&serve->batch, &job);
+    e = job_done_wait(&job_done);
+    job_done_deinit(&job_done);
+    if (e == 0) fprintf(
+        messages,
+        "wrote image of size %dx%d to '%.*s'\n",
+        job.width, job.height, str8_fmt(job.outfile_path)
+    );
+
+    done:
+    arena_deinit(&arena);
+    return e;
+}
+
+static void serve_conn_loop(void *arg) {
+    Serve_Conn *conn = arg;
+    Serve *serve = conn->serve;
+
+    for (;;) {
+        Str8 args = { 0 }, image = { 0 };
+        if (frame_read(conn->fd, &args) != 0) break;
+        if (frame_read(conn->fd, &image) != 0) {
+            free(args.ptr);
+            break;
+        }
+
+        char *messages_ptr = NULL;
+        size_t messages_len = 0;
+        FILE *messages = open_memstream(&messages_ptr, &messages_len);
+        Image_Buffer result = { 0 };
+        error e = 1;
+        if (messages != NULL) {
+            err_file = messages;
+            e = serve_process(serve, args, image, &result, messages);
+            err_file = NULL;
+            fclose(messages);
+        }
+
+        u8 status = e == 0 ? 0 : 1;
+        Str8 message = { .ptr = (u8 *)messages_ptr, .len = messages_len };
+        error write_e = frame_write_parts(
+            conn->fd, (Str8){ .ptr = &status, .len = 1 }, message
+        );
+        if (write_e == 0) write_e = frame_write(
+            conn->fd, (Str8){ .ptr = result.ptr, .len = result.len }
+        );
+
+        free(messages_ptr);
+        free(result.ptr);
+        free(args.ptr);
+        free(image.ptr);
+        if (write_e != 0) break;
+    }
+    // The descriptor stays open until the thread is joined, so that it is
+    // not reused while the server may still shut it down.
+    atom_store(&conn->finished, true);
+}
+
+// Joins the threads of connections that have closed, or of every
+// connection once the server is stopping.
+static void serve_reap_conns(Serve *serve, bool all) {
+    mutex_lock(&serve->mutex);
+    for (usize i = 0; i < serve->conns_len;) {
+        Serve_Conn *conn = serve->conns[i];
+        if (!all && !atom_load(&conn->finished)) {
+            i += 1;
+            continue;
+        }
+        serve->conns[i] = serve->conns[serve->conns_len - 1];
+        serve->conns_len -= 1;
+        mutex_unlock(&serve->mutex);
+        thread_join(&conn->thread);
+        close(conn->fd);
+        free(conn);
+        mutex_lock(&serve->mutex);
+    }
+    mutex_unlock(&serve->mutex);
+}
+
+static error serve_add_conn(Serve *serve, int fd) {
+    serve_reap_conns(serve, false);
+    Serve_Conn *conn = malloc(sizeof(Serve_Conn));
+    if (conn == NULL) return err("allocation failure");
+    *conn = (Serve_Conn){ .serve = serve, .fd = fd };
+
+    mutex_lock(&serve->mutex);
+    if (serve->conns_len == serve->conns_cap) {
+        usize new_cap = serve->conns_cap == 0 ? 16 : serve->conns_cap * 2;
+        Serve_Conn **new_conns = realloc(
+            serve->conns, new_cap * sizeof(Serve_Conn *)
+        );
+        if (new_conns == NULL) {
+            mutex_unlock(&serve->mutex);
+            free(conn);
+            return err("allocation failure");
+        }
+        serve->conns = new_conns;
+        serve->conns_cap = new_cap;
+    }
+    if (thread_create(&conn->thread, serve_conn_loop, conn) != 0) {
+        mutex_unlock(&serve->mutex);
+        free(conn);
+        return 1;
+    }
+    serve->conns[serve->conns_len] = conn;
+    serve->conns_len += 1;
+    mutex_unlock(&serve->mutex);
+    return 0;
+}
+
+static error serve_run(
+    Str8 socket_path,
+    usize workers_len,
+    usize memory_budget
+) {
+    struct sockaddr_un addr; try (serve_socket_address(socket_path, &addr));
+
+    // Refuse to take over a socket that another server is still answering
+    // on; otherwise clear out a stale one left behind by a crash. Anything
+    // other than a socket at the path is left alone.
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) return errf(
+            "'%.*s' exists and is not a socket", str8_fmt(socket_path)
+        );
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0) {
+            bool live =
+                connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+            close(probe);
+            if (live) return errf(
+                "a server is already listening on '%.*s'",
+                str8_fmt(socket_path)
+            );
+        }
+        unlink(addr.sun_path);
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) return err("failed to create socket");
+    // Requests read and write files with the server's privileges, so only its
+    // own user may connect. The mode is set before listening, until when no
+    // connection can be made. The socket is non-blocking, as a connection
+    // that poll reports may be gone by the time it is accepted.
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(listen_fd);
+        return errf("failed to listen on '%.*s'", str8_fmt(socket_path));
+    }
+    if (chmod(addr.sun_path, 0600) != 0 ||
+        listen(listen_fd, 64) != 0 ||
+        fcntl(listen_fd, F_SETFL, O_NONBLOCK) != 0
+    ) {
+        close(listen_fd);
+        unlink(addr.sun_path);
+        return errf("failed to listen on '%.*s'", str8_fmt(socket_path));
+    }
+    if (serve_signal_pipe[0] < 0 && (pipe(serve_signal_pipe) != 0 ||
+        fcntl(serve_signal_pipe[1], F_SETFL, O_NONBLOCK) != 0
+    )) {
+        close(listen_fd);
+        unlink(addr.sun_path);
+        return err("failed to create pipe");
+    }
+
+    // Other threads' system calls are restarted, as only the accept loop
+    // needs to know.
+    struct sigaction action = {
+        .sa_handler = serve_handle_signal,
+        .sa_flags = SA_RESTART,
+    };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Serve serve = { 0 };
+    mutex_init(&serve.mutex);
+    error e = arena_init(&serve.cache_arena, 1024 * 1024);
+    if (e == 0) e = batch_init(&serve.batch, workers_len, memory_budget);
+    if (e != 0) {
+        close(listen_fd);
+        unlink(addr.sun_path);
+        arena_deinit(&serve.cache_arena);
+        return e;
+    }
+
+    printf("listening on '%.*s'\n", str8_fmt(socket_path));
+    fflush(stdout);
+    struct pollfd fds[2] = {
+        { .fd = listen_fd, .events = POLLIN },
+        { .fd = serve_signal_pipe[0], .events = POLLIN },
+    };
+    while (!serve_stop) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            e = err("failed to wait for connections");
+            break;
+        }
+        if ((fds[0].revents & POLLIN) == 0) continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED ||
+                errno == EAGAIN || errno == EWOULDBLOCK
+            ) {
+                continue;
+            }
+            e = err("failed to accept connection");
+            break;
+        }
+        // Some systems pass the listening socket's O_NONBLOCK on.
+        if (fcntl(fd, F_SETFL, 0) != 0 || serve_add_conn(&serve, fd) != 0) {
+            close(fd);
+        }
+    }
+
+    close(listen_fd);
+    unlink(addr.sun_path);
+
+    mutex_lock(&serve.mutex);
+    for (usize i = 0; i < serve.conns_len; i += 1) {
+        shutdown(serve.conns[i]->fd, SHUT_RDWR);
+    }
+    mutex_unlock(&serve.mutex);
+    serve_reap_conns(&serve, true);
+    // Failures were reported to their clients, not to the server's stderr.
+    serve.batch.failed = 0;
+    batch_deinit(&serve.batch);
+
+    free(serve.conns);
+    arena_deinit(&serve.cache_arena);
+    mutex_deinit(&serve.mutex);
+    return e;
+}
+
+// Relative paths are resolved against the client's working directory, since
+// the server's may differ.
+static error client_path_arg(Arena *arena, Str8 path, Str8 *out) {
+    if (str8_eql(path, str8("-")) || (path.len > 0 && path.ptr[0] == '/')) {
+        *out = path;
+        return 0;
+    }
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return err("failed to get cwd");
+    usize cwd_len = strlen(cwd);
+    out->len = cwd_len + 1 + path.len;
+    try (arena_alloc(arena, out->len + 1, &out->ptr));
+    memcpy(out->ptr, cwd, cwd_len);
+    out->ptr[cwd_len] = '/';
+    memcpy(out->ptr + cwd_len + 1, path.ptr, path.len);
+    out->ptr[out->len] = '\0';
+    return 0;
+}
+
+static error client_read_stdin(Str8 *out) {
+    Image_Buffer buf = { 0 };
+    u8 chunk[64 * 1024];
+    for (;;) {
+        usize n = fread(chunk, 1, sizeof(chunk), stdin);
+        if (n > 0) image_buffer_write_func(&buf, chunk, (int)n);
+        if (n < sizeof(chunk)) break;
+    }
+    if (buf.failed || ferror(stdin)) {
+        free(buf.ptr);
+        return err("error reading standard input");
+    }
+    *out = (Str8){ .ptr = buf.ptr, .len = buf.len };
+    return 0;
+}
+
+// `args` are the request arguments as NUL-terminated strings, laid out one
+// after another.
+static error client_run(Str8 socket_path, Str8 args, bool input_from_stdin) {
+    struct sockaddr_un addr; try (serve_socket_address(socket_path, &addr));
+    signal(SIGPIPE, SIG_IGN);
+
+    Str8 image = { 0 };
+    if (input_from_stdin) try (client_read_stdin(&image));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) close(fd);
+        free(image.ptr);
+        return errf("failed to connect to '%.*s'", str8_fmt(socket_path));
+    }
+
+    Str8 status = { 0 }, result = { 0 };
+    error e = frame_write(fd, args);
+    if (e == 0) e = frame_write(fd, image);
+    if (e == 0) e = frame_read(fd, &status);
+    if (e == 0) e = frame_read(fd, &result);
+    close(fd);
+    free(image.ptr);
+    if (e != 0 || status.len == 0) {
+        free(status.ptr);
+        free(result.ptr);
+        return err("connection to server failed");
+    }
+
+    Str8 message = str8_range(status, 1, status.len);
+    e = status.ptr[0] == 0 ? 0 : 1;
+    if (e == 0) {
+        if (result.len > 0) {
+            fwrite(result.ptr, 1, result.len, stdout);
+        } else {
+            printf("%.*s", str8_fmt(message));
+        }
+    } else {
+        fprintf(stderr, "%.*s", str8_fmt(message));
+    }
+
+    free(status.ptr);
+    free(result.ptr);
+    return e;
+}
+
+#else
+
+static error serve_run(
+    Str8 socket_path,
+    usize workers_len,
+    usize memory_budget
+) {
+    (void)socket_path; (void)workers_len; (void)memory_budget;
+    return err("--serve is not supported on this platform");
+}
+
+static error client_path_arg(Arena *arena, Str8 path, Str8 *out) {
+    (void)arena; (void)path; (void)out;
+    return err("--client is not supported on this platform");
+}
+
+static error client_run(Str8 socket_path, Str8 args, bool input_from_stdin) {
+    (void)socket_path; (void)args; (void)input_from_stdin;
+    return err("--client is not supported on this platform");
+}
+
+#endif // _WIN32
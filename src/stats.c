@@ -0,0 +1,305 @@
+// Per-stage timings for --stats. Workers add to shared totals with atomics, so
+// a stage's time is the sum over every thread that ran it, not wall time. On
+// Linux, hardware counters from perf_event_open are added where the kernel
+// and CPU provide them, to tell stages bound by memory from those bound by
+// computation.
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define STATS_COUNTERS
+#endif // __linux__
+
+typedef enum Stats_Stage {
+    STATS_READ,
+    STATS_DECODE,
+    STATS_PALETTE,
+    STATS_INVERT,
+    STATS_QUANTISE,
+    STATS_ENCODE,
+    STATS_WRITE,
+    STATS_STAGES_LEN,
+} Stats_Stage;
+
+static const char *stats_stage_names[STATS_STAGES_LEN] = {
+    "read", "decode", "palette", "invert", "quantise", "encode", "write",
+};
+
+typedef enum Stats_Counter {
+    STATS_CYCLES,
+    STATS_INSTRUCTIONS,
+    STATS_CACHE_MISSES,
+    STATS_BRANCH_MISSES,
+    STATS_COUNTERS_LEN,
+} Stats_Counter;
+
+static const char *stats_counter_names[STATS_COUNTERS_LEN] = {
+    "cycles", "instructions", "cache_misses", "branch_misses",
+};
+
+// The start of a stage, from stats_begin.
+typedef struct Stats_Mark {
+    // The image the stage works on, for --trace.
+    Str8 input;
+    Str8 output;
+    u64 ns;
+    u64 counts[STATS_COUNTERS_LEN];
+    bool counted;
+} Stats_Mark;
+
+typedef struct Stats {
+    bool json;
+    // Optional; also records each stage as an event.
+    Trace *trace;
+    // Whether hardware counters could be opened when stats began.
+    bool counters;
+    u64 beg_ns;
+    u64 ns[STATS_STAGES_LEN];
+    u64 pixels[STATS_STAGES_LEN];
+    u64 bytes[STATS_STAGES_LEN];
+    u64 counts[STATS_STAGES_LEN][STATS_COUNTERS_LEN];
+    // Pixels of the stage runs that have counts, which is all of them unless
+    // some thread could not open its counters.
+    u64 counted_pixels[STATS_STAGES_LEN];
+    // Outputs encoded, which excludes those served from a cache.
+    usize outputs;
+    // Encoded inputs held in job arenas.
+    usize arena_bytes;
+    usize arena_peak;
+} Stats;
+
+#ifdef STATS_COUNTERS
+
+// Each thread opens its own group of counters on first use, which then counts
+// only that thread, and keeps it open until the process exits. -1 once opening
+// has failed, such as where the kernel does not allow it or in virtual
+// machines without a PMU.
+static thread_local_var int stats_counters_fd = -2;
+
+static int stats_counters_open(void) {
+    static const u64 configs[STATS_COUNTERS_LEN] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    int fds[STATS_COUNTERS_LEN];
+    for (usize i = 0; i < STATS_COUNTERS_LEN; i += 1) {
+        struct perf_event_attr attr = {
+            .size = sizeof(attr),
+            .type = PERF_TYPE_HARDWARE,
+            .config = configs[i],
+            .read_format = PERF_FORMAT_GROUP,
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+        };
+        fds[i] = (int)syscall(
+            SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0
+        );
+        if (fds[i] < 0) {
+            while (i > 0) close(fds[--i]);
+            return -1;
+        }
+    }
+    return fds[0];
+}
+
+// Reads the calling thread's counters, all at once through the group leader.
+static bool stats_counters_read(u64 out[STATS_COUNTERS_LEN]) {
+    if (stats_counters_fd == -2) stats_counters_fd = stats_counters_open();
+    if (stats_counters_fd < 0) return false;
+    // The number of counters, then their values.
+    u64 values[1 + STATS_COUNTERS_LEN];
+    if (read(stats_counters_fd, values, sizeof(values)) != sizeof(values)) {
+        return false;
+    }
+    memcpy(out, values + 1, sizeof(u64) * STATS_COUNTERS_LEN);
+    return true;
+}
+
+#else
+
+static bool stats_counters_read(u64 out[STATS_COUNTERS_LEN]) {
+    (void)out;
+    return false;
+}
+
+#endif // STATS_COUNTERS
+
+static void stats_init(Stats *stats, bool json) {
+    *stats = (Stats){ .json = json, .beg_ns = clock_now() };
+    u64 counts[STATS_COUNTERS_LEN];
+    stats->counters = stats_counters_read(counts);
+}
+
+// Returns the start to pass to stats_add, which is empty without stats. Paths
+// must stay valid until then.
+static Stats_Mark stats_begin(Stats *stats, Str8 input, Str8 output) {
+    Stats_Mark mark = { .input = input, .output = output };
+    if (stats == NULL) return mark;
+    if (stats->counters) mark.counted = stats_counters_read(mark.counts);
+    mark.ns = clock_now();
+    return mark;
+}
+
+static void stats_add(
+    Stats *stats,
+    Stats_Stage stage,
+    Stats_Mark mark,
+    u64 pixels,
+    u64 bytes
+) {
+    if (stats == NULL) return;
+    u64 end_ns = clock_now();
+    atom_add(&stats->ns[stage], end_ns - mark.ns);
+    u64 counts[STATS_COUNTERS_LEN];
+    if (mark.counted && stats_counters_read(counts)) {
+        for (usize i = 0; i < STATS_COUNTERS_LEN; i += 1) {
+            atom_add(&stats->counts[stage][i], counts[i] - mark.counts[i]);
+        }
+        atom_add(&stats->counted_pixels[stage], pixels);
+    }
+    atom_add(&stats->pixels[stage], pixels);
+    atom_add(&stats->bytes[stage], bytes);
+    if (stats->trace != NULL) trace_event(
+        stats->trace, stats_stage_names[stage], mark.ns, end_ns,
+        mark.input, mark.output
+    );
+}
+
+static void stats_arena_acquire(Stats *stats, usize bytes) {
+    if (stats == NULL) return;
+    usize now = atom_add(&stats->arena_bytes, bytes) + bytes;
+    usize peak = atom_load(&stats->arena_peak);
+    while (peak < now && !atom_cas(&stats->arena_peak, &peak, now));
+}
+
+static void stats_arena_release(Stats *stats, usize bytes) {
+    if (stats != NULL) atom_sub(&stats->arena_bytes, bytes);
+}
+
+static f64 stats_rate(u64 amount, u64 ns) {
+    return ns == 0 ? 0 : (f64)amount / 1e6 / ((f64)ns / 1e9);
+}
+
+static f64 stats_ratio(u64 a, u64 b) {
+    return b == 0 ? 0 : (f64)a / (f64)b;
+}
+
+// Reports to stderr, which leaves stdout to outputs written there. `arena`
+// is the long-lived arena that holds the arguments.
+static void stats_print(Stats *stats, const Arena *arena) {
+    u64 wall_ns = clock_now() - stats->beg_ns;
+    FILE *out = stderr;
+    if (stats->json) {
+        fprintf(
+            out,
+            "{\"wall_ms\":%.3f,\"outputs\":%zu,\"counters\":%s,"
+                "\"stages\":{",
+            (f64)wall_ns / 1e6, stats->outputs,
+            stats->counters ? "true" : "false"
+        );
+        for (usize i = 0; i < STATS_STAGES_LEN; i += 1) {
+            fprintf(
+                out,
+                "%s\"%s\":{\"ms\":%.3f,\"pixels\":%llu,\"bytes\":%llu,"
+                    "\"mp_per_s\":%.3f,\"mb_per_s\":%.3f",
+                i == 0 ? "" : ",",
+                stats_stage_names[i],
+                (f64)stats->ns[i] / 1e6,
+                (unsigned long long)stats->pixels[i],
+                (unsigned long long)stats->bytes[i],
+                stats_rate(stats->pixels[i], stats->ns[i]),
+                stats_rate(stats->bytes[i], stats->ns[i])
+            );
+            const u64 *counts = stats->counts[i];
+            if (stats->counters) {
+                for (usize c = 0; c < STATS_COUNTERS_LEN; c += 1) {
+                    fprintf(
+                        out, ",\"%s\":%llu",
+                        stats_counter_names[c], (unsigned long long)counts[c]
+                    );
+                }
+                fprintf(
+                    out,
+                    ",\"ipc\":%.3f,\"cache_misses_per_pixel\":%.4f,"
+                        "\"branch_misses_per_pixel\":%.4f",
+                    stats_ratio(
+                        counts[STATS_INSTRUCTIONS], counts[STATS_CYCLES]
+                    ),
+                    stats_ratio(
+                        counts[STATS_CACHE_MISSES], stats->counted_pixels[i]
+                    ),
+                    stats_ratio(
+                        counts[STATS_BRANCH_MISSES], stats->counted_pixels[i]
+                    )
+                );
+            }
+            fprintf(out, "}");
+        }
+        fprintf(
+            out,
+            "},\"arena_peak_bytes\":%zu,\"arena_args_bytes\":%zu}\n",
+            stats->arena_peak, arena->offset
+        );
+        return;
+    }
+
+    fprintf(
+        out, "%-10s %12s %10s %10s", "stage", "time (ms)", "MP/s", "MB/s"
+    );
+    if (stats->counters) {
+        fprintf(
+            out, " %6s %13s %14s", "IPC", "cache-miss/px", "branch-miss/px"
+        );
+    }
+    fprintf(out, "\n");
+    for (usize i = 0; i < STATS_STAGES_LEN; i += 1) {
+        if (stats->ns[i] == 0) continue;
+        fprintf(
+            out, "%-10s %12.3f ", stats_stage_names[i], (f64)stats->ns[i] / 1e6
+        );
+        // Reading and writing move bytes, not pixels.
+        f64 mp_per_s = stats_rate(stats->pixels[i], stats->ns[i]);
+        if (stats->pixels[i] == 0) fprintf(out, "%10s ", "-");
+        else fprintf(out, "%10.2f ", mp_per_s);
+        fprintf(out, "%10.2f", stats_rate(stats->bytes[i], stats->ns[i]));
+        const u64 *counts = stats->counts[i];
+        if (stats->counters) {
+            fprintf(
+                out, " %6.2f",
+                stats_ratio(counts[STATS_INSTRUCTIONS], counts[STATS_CYCLES])
+            );
+            if (stats->counted_pixels[i] == 0) {
+                fprintf(out, " %13s %14s", "-", "-");
+            } else {
+                fprintf(
+                    out, " %13.4f %14.4f",
+                    stats_ratio(
+                        counts[STATS_CACHE_MISSES], stats->counted_pixels[i]
+                    ),
+                    stats_ratio(
+                        counts[STATS_BRANCH_MISSES], stats->counted_pixels[i]
+                    )
+                );
+            }
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(
+        out,
+        "%-10s %12.3f (%zu output%s)\n",
+        "wall", (f64)wall_ns / 1e6, stats->outputs,
+        stats->outputs == 1 ? "" : "s"
+    );
+    fprintf(
+        out,
+        "arena peak: %.2f MiB of inputs, %.2f MiB of arguments\n",
+        (f64)stats->arena_peak / (1024.0 * 1024.0),
+        (f64)arena->offset / (1024.0 * 1024.0)
+    );
+    #ifdef STATS_COUNTERS
+        if (!stats->counters) fprintf(out, "hardware counters unavailable\n");
+    #endif // STATS_COUNTERS
+}
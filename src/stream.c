@@ -0,0 +1,294 @@
+// Raw video mode (--raw-rgb): quantises a continuous stream of packed rgb24
+// frames, as produced by `ffmpeg -f rawvideo -pix_fmt rgb24`. A reader and a
+// writer thread keep the input and output moving while the calling thread
+// quantises, cycling a fixed set of frame buffers between the three. The
+// nearest-colour memo persists across frames, and without dithering, so does
+// the previous frame, to skip blocks that have not changed.
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif // _WIN32
+
+// One buffer being read, one quantised and one written.
+#define stream_buffers_len 3
+
+// Bounded FIFO of buffer indices handed from one stage to the next.
+typedef struct Stream_Queue {
+    Mutex mutex;
+    Cond cond;
+    usize items[stream_buffers_len];
+    usize head;
+    usize len;
+    bool closed;
+} Stream_Queue;
+
+static void stream_queue_init(Stream_Queue *queue) {
+    *queue = (Stream_Queue){ 0 };
+    mutex_init(&queue->mutex);
+    cond_init(&queue->cond);
+}
+
+static void stream_queue_deinit(Stream_Queue *queue) {
+    mutex_deinit(&queue->mutex);
+    cond_deinit(&queue->cond);
+}
+
+static void stream_queue_push(Stream_Queue *queue, usize item) {
+    mutex_lock(&queue->mutex);
+    queue->items[(queue->head + queue->len) % stream_buffers_len] = item;
+    queue->len += 1;
+    cond_signal(&queue->cond);
+    mutex_unlock(&queue->mutex);
+}
+
+static void stream_queue_close(Stream_Queue *queue) {
+    mutex_lock(&queue->mutex);
+    queue->closed = true;
+    cond_broadcast(&queue->cond);
+    mutex_unlock(&queue->mutex);
+}
+
+// Returns false once the queue is closed and drained.
+static bool stream_queue_pop(Stream_Queue *queue, usize *out) {
+    mutex_lock(&queue->mutex);
+    while (queue->len == 0 && !queue->closed) {
+        cond_wait(&queue->cond, &queue->mutex);
+    }
+    bool ok = queue->len != 0;
+    if (ok) {
+        *out = queue->items[queue->head];
+        queue->head = (queue->head + 1) % stream_buffers_len;
+        queue->len -= 1;
+    }
+    mutex_unlock(&queue->mutex);
+    return ok;
+}
+
+typedef struct Stream {
+    FILE *in;
+    FILE *out;
+    usize frame_len;
+    u8 *buffers[stream_buffers_len];
+    // free -> reader -> filled -> quantiser -> done -> writer -> free
+    Stream_Queue free;
+    Stream_Queue filled;
+    Stream_Queue done;
+    bool read_failed;
+    bool write_failed;
+    Stats *stats;
+    Str8 infile_path;
+    Str8 outfile_path;
+} Stream;
+
+static Stats_Mark stream_mark(Stream *stream) {
+    return stats_begin(
+        stream->stats, stream->infile_path, stream->outfile_path
+    );
+}
+
+static void stream_reader(void *arg) {
+    Stream *stream = arg;
+    for (usize buffer_i; stream_queue_pop(&stream->free, &buffer_i);) {
+        Stats_Mark mark = stream_mark(stream);
+        usize read = fread(
+            stream->buffers[buffer_i], 1, stream->frame_len, stream->in
+        );
+        if (read != stream->frame_len) {
+            // A clean end of stream falls exactly on a frame boundary.
+            stream->read_failed = read != 0 || ferror(stream->in);
+            break;
+        }
+        stats_add(stream->stats, STATS_READ, mark, 0, stream->frame_len);
+        stream_queue_push(&stream->filled, buffer_i);
+    }
+    stream_queue_close(&stream->filled);
+}
+
+static void stream_writer(void *arg) {
+    Stream *stream = arg;
+    for (usize buffer_i; stream_queue_pop(&stream->done, &buffer_i);) {
+        // After a failed write, keep draining so the other stages can finish.
+        if (!stream->write_failed) {
+            Stats_Mark mark = stream_mark(stream);
+            stream->write_failed = fwrite(
+                stream->buffers[buffer_i], 1, stream->frame_len, stream->out
+            ) != stream->frame_len;
+            stats_add(stream->stats, STATS_WRITE, mark, 0, stream->frame_len);
+            if (stream->stats != NULL) atom_add(&stream->stats->outputs, 1);
+        }
+        stream_queue_push(&stream->free, buffer_i);
+    }
+    if (fflush(stream->out) != 0) stream->write_failed = true;
+    // Unblocks the reader if the quantiser stopped early.
+    stream_queue_close(&stream->free);
+}
+
+static error stream_open(Str8 path, bool write, FILE **out) {
+    if (str8_eql(path, str8("-"))) {
+        *out = write ? stdout : stdin;
+        #ifdef _WIN32
+            _setmode(_fileno(*out), _O_BINARY);
+        #endif // _WIN32
+        return 0;
+    }
+    return file_open(path, write ? "wb" : "rb", out);
+}
+
+static error stream_run(
+    const Job_Options *options,
+    usize width,
+    usize height,
+    usize threads_len,
+    Stats *stats,
+    bool verify,
+    Str8 infile_path,
+    Str8 outfile_path
+) {
+    if (width == 0 || height == 0) return err("invalid frame size");
+
+    Stream stream = {
+        .frame_len = width * height * 3,
+        .stats = stats,
+        .infile_path = infile_path,
+        .outfile_path = outfile_path,
+    };
+    if (stream.frame_len / 3 / width != height) {
+        return err("invalid frame size");
+    }
+    try (stream_open(infile_path, false, &stream.in));
+    error e = stream_open(outfile_path, true, &stream.out);
+    if (e != 0) {
+        if (stream.in != stdin) fclose(stream.in);
+        return e;
+    }
+
+    // A generated palette comes from the first frame and is kept for the rest,
+    // so that colours do not flicker between frames.
+    Palette palette = options->palette;
+    Rgb generated_palette[palette_generated_max];
+    bool generate_palette = options->palette_spec.method != PALETTE_GIVEN;
+    usize palette_len = generate_palette ?
+        options->palette_spec.colours_len : palette.len;
+
+    u8 *memo = NULL;
+    if (palette_len <= image_memo_palette_max) {
+        memo = calloc(image_memo_len, 1);
+    }
+    for (usize i = 0; i < stream_buffers_len; i += 1) {
+        stream.buffers[i] = malloc(stream.frame_len);
+        if (stream.buffers[i] == NULL) e = err("allocation failure");
+    }
+    // With --verify, each input frame is also quantised here by the
+    // reference quantiser.
+    u8 *reference = NULL;
+    if (e == 0 && verify) {
+        reference = malloc(stream.frame_len);
+        if (reference == NULL) e = err("allocation failure");
+    }
+
+    // Diffusion carries error across the whole frame, so the result of a
+    // block depends on more than its own pixels.
+    Image_Frame_Cache cache = { 0 };
+    bool use_cache = options->algorithm.len == 0;
+    if (e == 0 && use_cache) {
+        e = image_frame_cache_init(&cache, stream.frame_len);
+    }
+
+    stream_queue_init(&stream.free);
+    stream_queue_init(&stream.filled);
+    stream_queue_init(&stream.done);
+    for (usize i = 0; i < stream_buffers_len; i += 1) {
+        stream_queue_push(&stream.free, i);
+    }
+
+    Thread reader = { 0 }, writer = { 0 };
+    bool reader_started = false, writer_started = false;
+    if (e == 0) e = thread_create(&reader, stream_reader, &stream);
+    reader_started = e == 0;
+    if (e == 0) e = thread_create(&writer, stream_writer, &stream);
+    writer_started = e == 0;
+
+    if (e == 0) {
+        usize frame_i = 0;
+        for (usize buffer_i; stream_queue_pop(&stream.filled, &buffer_i);) {
+            u8 *frame = stream.buffers[buffer_i];
+            usize pixels = width * height;
+            Stats_Mark mark = stream_mark(&stream);
+            if (options->invert) {
+                image_invert(frame, stream.frame_len);
+                stats_add(
+                    stats, STATS_INVERT, mark, pixels, stream.frame_len
+                );
+            }
+            if (generate_palette) {
+                generate_palette = false;
+                mark = stream_mark(&stream);
+                e = palette_generate(
+                    &options->palette_spec, frame, width, height,
+                    threads_len, generated_palette, &palette.len
+                );
+                palette.ptr = generated_palette;
+                // Closing the queues below lets the reader stop by itself.
+                if (e != 0) break;
+                stats_add(
+                    stats, STATS_PALETTE, mark, pixels, stream.frame_len
+                );
+            }
+            if (reference != NULL) memcpy(reference, frame, stream.frame_len);
+            mark = stream_mark(&stream);
+            if (use_cache) {
+                image_quantise_cached(
+                    frame, width, height, palette, memo, &cache
+                );
+            } else {
+                image_quantise_memo(
+                    frame,
+                    width,
+                    height,
+                    palette,
+                    options->algorithm,
+                    memo
+                );
+            }
+            stats_add(stats, STATS_QUANTISE, mark, pixels, stream.frame_len);
+            if (reference != NULL) {
+                image_quantise_reference(
+                    reference, width, height, palette, options->algorithm
+                );
+                e = image_verify(
+                    frame, reference, width, height, outfile_path, frame_i
+                );
+                if (e != 0) break;
+            }
+            frame_i += 1;
+            stream_queue_push(&stream.done, buffer_i);
+        }
+    }
+    stream_queue_close(&stream.done);
+    if (!writer_started) stream_queue_close(&stream.free);
+    if (writer_started) thread_join(&writer);
+    if (reader_started) thread_join(&reader);
+
+    stream_queue_deinit(&stream.free);
+    stream_queue_deinit(&stream.filled);
+    stream_queue_deinit(&stream.done);
+    for (usize i = 0; i < stream_buffers_len; i += 1) free(stream.buffers[i]);
+    free(memo);
+    free(reference);
+    if (use_cache) image_frame_cache_deinit(&cache);
+    if (stream.in != stdin) fclose(stream.in);
+    if (stream.out != stdout && fclose(stream.out) != 0) {
+        stream.write_failed = true;
+    }
+
+    if (e != 0) return e;
+    if (stream.read_failed) return errf(
+        "error reading '%.*s': expected whole frames of %zu bytes",
+        str8_fmt(infile_path), stream.frame_len
+    );
+    if (stream.write_failed) return errf(
+        "error writing '%.*s'", str8_fmt(outfile_path)
+    );
+    return 0;
+}
@@ -0,0 +1,490 @@
+// Tests for the quantiser, built separately from the tool:
+//
+//     cc src/test.c -O2 -lm -lpthread -o ./imgclr-test && ./imgclr-test
+//
+// Quantises synthetic images, generated from a fixed seed, through each of the
+// tool's fast paths and compares the result pixel for pixel with
+// image_quantise_reference: every nearest-colour search with and without a
+// memo, the dispatch with its unique-colour collapse, the grey path, the frame
+// cache of --raw-rgb, 1-bit PNG and BMP output, and --tiled strips. Prints
+// each case that differs, and exits nonzero if there is any. The --tiled
+// cases write two scratch files to the working directory.
+
+#include "base.c"
+#include "imgclr.c"
+
+// The rest of the tool, for tile_run, of which the tests call only part.
+#ifdef __GNUC__
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wunused-function"
+#endif // __GNUC__
+#include "args.c"
+#include "pool.c"
+#include "dir.c"
+#include "hash.c"
+#include "cache.c"
+#include "reference.c"
+#include "clock.c"
+#include "trace.c"
+#include "stats.c"
+#include "measure.c"
+#include "calibrate.c"
+#include "job.c"
+#include "walk.c"
+#include "serve.c"
+#include "stream.c"
+#include "tile.c"
+#ifdef __GNUC__
+    #pragma GCC diagnostic pop
+#endif // __GNUC__
+
+#define test_tile_in "imgclr-test-in.ppm"
+#define test_tile_out "imgclr-test-out.ppm"
+
+typedef enum {
+    TEST_GRADIENT,
+    TEST_NOISE,
+    // A few dozen colours in runs, as in artwork.
+    TEST_FLAT,
+    TEST_IMAGES_LEN,
+} Test_Image;
+
+static const char *test_image_names[TEST_IMAGES_LEN] = {
+    "gradient", "noise", "flat",
+};
+
+typedef struct {
+    usize width;
+    usize height;
+} Test_Size;
+
+// The largest has more distinct colours of noise than image_quantise_unique
+// keeps, so that it stops part way.
+static const Test_Size test_sizes[] = { { 1, 9 }, { 37, 23 }, { 128, 96 } };
+#define test_pixels_max (128 * 96)
+
+typedef struct {
+    const char *name;
+    const Dither_Algorithm *algorithm;
+} Test_Algorithm;
+
+static const Test_Algorithm test_algorithms[] = {
+    { "none", &none },
+    { "floyd-steinberg", &floyd_steinberg },
+    { "atkinson", &atkinson },
+    { "jjn", &jjn },
+    { "burkes", &burkes },
+    { "sierra-lite", &sierra_lite },
+};
+
+// Around each size class of the search dispatch table, the memo's limit and
+// search_palette_max.
+static const usize test_palette_lens[] = {
+    2, 3, 4, 8, 16, 17, 64, 255, 256, 300,
+};
+#define test_palette_max 300
+
+static const usize test_strip_rows[] = { 1, 2, 5, 16, 1000 };
+
+typedef struct {
+    Test_Image image;
+    Test_Size size;
+    const Test_Algorithm *algorithm;
+    Palette palette;
+    // The source image, and the reference's result for it.
+    const u8 *source;
+    u8 *expected;
+} Test_Case;
+
+typedef struct {
+    usize cases_len;
+    usize failed_len;
+    u8 *scratch;
+    u8 *grey;
+} Test;
+
+// xorshift64*, for images and palettes that are the same on every platform.
+static u64 test_random(u64 *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static void test_image_generate(
+    Test_Image image,
+    usize width,
+    usize height,
+    u8 *out
+) {
+    u64 state = 0x9e3779b97f4a7c15ull + image;
+    u8 flat[48][3];
+    for (usize i = 0; i < count_of(flat); i += 1) {
+        u64 r = test_random(&state);
+        flat[i][0] = (u8)r, flat[i][1] = (u8)(r >> 8);
+        flat[i][2] = (u8)(r >> 16);
+    }
+    usize flat_i = 0;
+    for (usize i = 0; i < width * height; i += 1) {
+        usize x = i % width, y = i / width;
+        u8 *pixel = out + 3 * i;
+        u64 r = test_random(&state);
+        switch (image) {
+            case TEST_GRADIENT: {
+                pixel[0] = (u8)(255 * x / width);
+                pixel[1] = (u8)(255 * y / height);
+                pixel[2] = (u8)(255 * (width - x) * y / (width * height));
+            } break;
+            case TEST_NOISE: {
+                pixel[0] = (u8)r, pixel[1] = (u8)(r >> 8);
+                pixel[2] = (u8)(r >> 16);
+            } break;
+            default: {
+                if ((r >> 32) % 8 == 0) flat_i = (r >> 40) % count_of(flat);
+                memcpy(pixel, flat[flat_i], 3);
+            } break;
+        }
+    }
+}
+
+// Black and white, then colours from a fixed seed, or greys for `grey`.
+static void test_palette_generate(usize len, bool grey, Rgb *out) {
+    u64 state = 0x2545f4914f6cdd1dull + len;
+    out[0] = (Rgb){ 0 };
+    out[1] = (Rgb){ .r = 255, .g = 255, .b = 255 };
+    for (usize i = 2; i < len; i += 1) {
+        u64 r = test_random(&state);
+        out[i] = (Rgb){ .r = (u8)r, .g = (u8)(r >> 8), .b = (u8)(r >> 16) };
+        if (grey) out[i].g = out[i].b = out[i].r;
+    }
+}
+
+// Counts the case, and reports it if `got` differs from `expected`.
+static void test_check(
+    Test *test,
+    const Test_Case *c,
+    const char *path,
+    const u8 *got,
+    const u8 *expected,
+    usize frame_i
+) {
+    char name[128];
+    snprintf(
+        name, sizeof(name), "%s, %s %zux%zu, %s, %zu colours",
+        path, test_image_names[c->image], c->size.width, c->size.height,
+        c->algorithm->name, c->palette.len
+    );
+    test->cases_len += 1;
+    if (image_verify(
+        got, expected, c->size.width, c->size.height, str8_from_cstr(name),
+        frame_i
+    ) != 0) {
+        test->failed_len += 1;
+    }
+}
+
+// Each search on its own, with and without a memo, then as dispatched, which
+// without dithering searches once per distinct colour.
+static error test_searches(Test *test, const Test_Case *c) {
+    usize width = c->size.width, height = c->size.height;
+    usize data_len = width * height * 3;
+    for (usize kind = 0; kind < SEARCH_KINDS_LEN; kind += 1) {
+        if (!search_kind_supports(kind, c->palette.len)) continue;
+        Search search;
+        search_init(&search, c->palette, kind);
+        for (usize memoised = 0; memoised < 2; memoised += 1) {
+            if (memoised && c->palette.len > image_memo_palette_max) break;
+            u8 *memo = NULL;
+            if (memoised) {
+                memo = calloc(image_memo_len, 1);
+                if (memo == NULL) return err("allocation failure");
+            }
+            memcpy(test->scratch, c->source, data_len);
+            image_quantise_search(
+                test->scratch, width, height, &search, *c->algorithm->algorithm,
+                memo
+            );
+            free(memo);
+            char path[64];
+            snprintf(
+                path, sizeof(path), "%s search%s", search_kind_names[kind],
+                memoised ? " with memo" : ""
+            );
+            test_check(test, c, path, test->scratch, c->expected, 0);
+        }
+    }
+    memcpy(test->scratch, c->source, data_len);
+    image_quantise(
+        test->scratch, width, height, c->palette, *c->algorithm->algorithm
+    );
+    test_check(
+        test, c, c->algorithm->algorithm->len == 0 ? "unique colours" :
+            "dispatch",
+        test->scratch, c->expected, 0
+    );
+    return 0;
+}
+
+// Three frames of --raw-rgb without dithering: the source, the source with a
+// block changed, and the same again, which is copied from the cache.
+static error test_frame_cache(Test *test, const Test_Case *c) {
+    usize width = c->size.width, height = c->size.height;
+    usize data_len = width * height * 3;
+    Image_Frame_Cache cache;
+    try (image_frame_cache_init(&cache, data_len));
+    u8 *memo = NULL;
+    if (c->palette.len <= image_memo_palette_max) {
+        memo = calloc(image_memo_len, 1);
+    }
+    u8 *frame = malloc(data_len), *expected = malloc(data_len);
+    if (frame == NULL || expected == NULL) {
+        free(frame);
+        free(expected);
+        free(memo);
+        image_frame_cache_deinit(&cache);
+        return err("allocation failure");
+    }
+    memcpy(frame, c->source, data_len);
+    for (usize frame_i = 0; frame_i < 3; frame_i += 1) {
+        if (frame_i == 1) {
+            for (usize i = 0; i < data_len; i += 1) {
+                usize x = i / 3 % width, y = i / 3 / width;
+                if (x >= width / 2 && y < height / 2) frame[i] ^= 0x5a;
+            }
+        }
+        memcpy(expected, frame, data_len);
+        image_quantise_reference(
+            expected, width, height, c->palette, *c->algorithm->algorithm
+        );
+        memcpy(test->scratch, frame, data_len);
+        image_quantise_cached(
+            test->scratch, width, height, c->palette, memo, &cache
+        );
+        test_check(test, c, "frame cache", test->scratch, expected, frame_i);
+    }
+    free(frame);
+    free(expected);
+    free(memo);
+    image_frame_cache_deinit(&cache);
+    return 0;
+}
+
+// Encodes `data` to memory and decodes it again as rgb.
+static error test_round_trip(
+    Test *test,
+    const Test_Case *c,
+    const char *path,
+    Format format,
+    const u8 *data,
+    int channels
+) {
+    Image_Buffer buf = { 0 };
+    error e = image_write_buffer(
+        &buf, format, data, (int)c->size.width, (int)c->size.height,
+        channels, c->palette, NULL
+    );
+    int width = 0, height = 0, file_channels = 0;
+    u8 *decoded = NULL;
+    if (e == 0) {
+        decoded = stbi_load_from_memory(
+            buf.ptr, (int)buf.len, &width, &height, &file_channels, 3
+        );
+        if (decoded == NULL) e = errf("%s: %s", path, stbi_failure_reason());
+    }
+    free(buf.ptr);
+    if (e != 0) {
+        test->cases_len += 1;
+        test->failed_len += 1;
+        return 0;
+    }
+    test_check(test, c, path, decoded, c->expected, 0);
+    stbi_image_free(decoded);
+    return 0;
+}
+
+// The grey path quantises one channel where image and palette are grey, and
+// inverts it on its own. `c` is the rgb form of the grey image.
+static error test_grey(Test *test, const Test_Case *c, bool invert) {
+    usize width = c->size.width, height = c->size.height;
+    usize pixels_len = width * height;
+    for (usize i = 0; i < pixels_len; i += 1) {
+        test->grey[i] = c->source[3 * i];
+    }
+    if (invert) image_invert_grey(test->grey, pixels_len);
+    image_quantise_grey(
+        test->grey, width, height, c->palette, *c->algorithm->algorithm
+    );
+    image_rgb_from_grey(test->grey, pixels_len, test->scratch);
+    test_check(
+        test, c, invert ? "inverted grey" : "grey", test->scratch,
+        c->expected, 0
+    );
+    if (c->palette.len == 2 && !invert) {
+        try (test_round_trip(
+            test, c, "1-bit grey PNG", FORMAT_PNG, test->grey, 1
+        ));
+        try (test_round_trip(
+            test, c, "1-bit grey BMP", FORMAT_BMP, test->grey, 1
+        ));
+    }
+    return 0;
+}
+
+// Whole strips through tile_run, by way of files as --tiled reads them.
+static error test_tiled(Test *test, const Test_Case *c, bool invert) {
+    usize width = c->size.width, height = c->size.height;
+    usize data_len = width * height * 3;
+    Job_Options options = {
+        .palette = c->palette,
+        .algorithm = *c->algorithm->algorithm,
+        .invert = invert,
+    };
+    FILE *file = NULL;
+    try (file_open(str8(test_tile_in), "wb", &file));
+    fprintf(file, "P6\n%zu %zu\n255\n", width, height);
+    fwrite(c->source, 1, data_len, file);
+    if (fclose(file) != 0) return err("error writing " test_tile_in);
+
+    for (usize i = 0; i < count_of(test_strip_rows); i += 1) {
+        char path[64];
+        snprintf(
+            path, sizeof(path), "%s%zu-row strips",
+            invert ? "inverted, " : "", test_strip_rows[i]
+        );
+        error e = tile_run(
+            &options, test_strip_rows[i], NULL, str8(test_tile_in),
+            str8(test_tile_out)
+        );
+        int out_width = 0, out_height = 0, channels = 0;
+        u8 *out = NULL;
+        if (e == 0) {
+            out = stbi_load(
+                test_tile_out, &out_width, &out_height, &channels, 3
+            );
+            if (out == NULL || (usize)out_width != width ||
+                (usize)out_height != height
+            ) {
+                e = errf("%s: unreadable output", path);
+            }
+        }
+        if (e != 0) {
+            test->cases_len += 1;
+            test->failed_len += 1;
+        } else {
+            test_check(test, c, path, out, c->expected, 0);
+        }
+        stbi_image_free(out);
+    }
+    remove(test_tile_in);
+    remove(test_tile_out);
+    return 0;
+}
+
+// Every path for one case. `source` is not inverted; the reference's result
+// is of the inverted image where `invert` is set, which only the grey path
+// and --tiled are run with, as they invert on their own. Elsewhere inverting
+// comes before any quantiser.
+static error test_case_run(Test *test, Test_Case *c, bool grey, bool invert) {
+    usize width = c->size.width, height = c->size.height;
+    usize data_len = width * height * 3;
+    memcpy(c->expected, c->source, data_len);
+    if (invert) image_invert(c->expected, data_len);
+    image_quantise_reference(
+        c->expected, width, height, c->palette, *c->algorithm->algorithm
+    );
+    bool tiled = c->palette.len <= 16 ||
+        c->palette.len > search_palette_max;
+
+    if (grey) return test_grey(test, c, invert);
+    if (invert) return tiled ? test_tiled(test, c, true) : 0;
+    try (test_searches(test, c));
+    if (c->algorithm->algorithm->len == 0) try (test_frame_cache(test, c));
+    if (c->palette.len == 2) {
+        // The fast path's output, as the tool would encode it.
+        memcpy(test->scratch, c->source, data_len);
+        image_quantise(
+            test->scratch, width, height, c->palette, *c->algorithm->algorithm
+        );
+        try (test_round_trip(
+            test, c, "1-bit PNG", FORMAT_PNG, test->scratch, 3
+        ));
+        try (test_round_trip(
+            test, c, "1-bit BMP", FORMAT_BMP, test->scratch, 3
+        ));
+    }
+    if (tiled) try (test_tiled(test, c, false));
+    return 0;
+}
+
+// Every palette, algorithm and inversion for one image.
+static error test_image_run(
+    Test *test,
+    Test_Image image,
+    Test_Size size,
+    bool grey,
+    u8 *source,
+    u8 *expected
+) {
+    usize data_len = size.width * size.height * 3;
+    test_image_generate(image, size.width, size.height, source);
+    if (grey) {
+        for (usize i = 0; i < data_len; i += 3) {
+            memset(source + i, source[i + 1], 3);
+        }
+    }
+    Rgb colours[test_palette_max];
+    for (usize p = 0; p < count_of(test_palette_lens); p += 1) {
+        test_palette_generate(test_palette_lens[p], grey, colours);
+        for (usize a = 0; a < count_of(test_algorithms); a += 1) {
+            Test_Case c = {
+                .image = image,
+                .size = size,
+                .algorithm = &test_algorithms[a],
+                .palette = { .ptr = colours, .len = test_palette_lens[p] },
+                .source = source,
+                .expected = expected,
+            };
+            try (test_case_run(test, &c, grey, false));
+            try (test_case_run(test, &c, grey, true));
+        }
+    }
+    return 0;
+}
+
+static error test_run(Test *test) {
+    u8 *source = malloc(test_pixels_max * 3);
+    u8 *expected = malloc(test_pixels_max * 3);
+    test->scratch = malloc(test_pixels_max * 3);
+    test->grey = malloc(test_pixels_max);
+    error e = 0;
+    if (source == NULL || expected == NULL || test->scratch == NULL ||
+        test->grey == NULL
+    ) {
+        e = err("allocation failure");
+    }
+    for (usize image = 0; e == 0 && image < TEST_IMAGES_LEN; image += 1) {
+        for (usize i = 0; e == 0 && i < count_of(test_sizes); i += 1) {
+            e = test_image_run(
+                test, image, test_sizes[i], false, source, expected
+            );
+            if (e == 0) e = test_image_run(
+                test, image, test_sizes[i], true, source, expected
+            );
+        }
+    }
+    free(source);
+    free(expected);
+    free(test->scratch);
+    free(test->grey);
+    return e;
+}
+
+int main(void) {
+    Test test = { 0 };
+    if (test_run(&test) != 0) return 1;
+    printf(
+        "%zu of %zu cases differ from the reference\n",
+        test.failed_len, test.cases_len
+    );
+    return test.failed_len != 0;
+}
@@ -0,0 +1,118 @@
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+#endif // _WIN32
+
+typedef void (*Thread_Fn)(void *arg);
+
+// The Thread must outlive the thread it starts, since the trampoline reads
+// `fn` and `arg` from it.
+typedef struct Thread {
+    Thread_Fn fn;
+    void *arg;
+    #ifdef _WIN32
+        HANDLE handle;
+    #else
+        pthread_t handle;
+    #endif // _WIN32
+} Thread;
+
+#ifdef _WIN32
+    typedef SRWLOCK Mutex;
+    typedef CONDITION_VARIABLE Cond;
+#else
+    typedef pthread_mutex_t Mutex;
+    typedef pthread_cond_t Cond;
+#endif // _WIN32
+
+#define atom_load(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define atom_store(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define atom_add(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_ACQ_REL)
+#define atom_sub(ptr, val) __atomic_fetch_sub(ptr, val, __ATOMIC_ACQ_REL)
+// Stores `val` if `*ptr` equals `*expected`, or else loads `*ptr` into
+// `*expected`. May fail spuriously, so is called in a loop.
+#define atom_cas(ptr, expected, val) __atomic_compare_exchange_n( \
+    ptr, expected, val, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE \
+)
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+    Thread *thread = param;
+    thread->fn(thread->arg);
+    return 0;
+}
+
+static error thread_create(Thread *thread, Thread_Fn fn, void *arg) {
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, thread_trampoline, thread, 0, NULL);
+    if (thread->handle == NULL) return err("failed to create thread");
+    return 0;
+}
+
+static void thread_join(Thread *thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+static void mutex_init(Mutex *mutex) { InitializeSRWLock(mutex); }
+static void mutex_deinit(Mutex *mutex) { (void)mutex; }
+static void mutex_lock(Mutex *mutex) { AcquireSRWLockExclusive(mutex); }
+static void mutex_unlock(Mutex *mutex) { ReleaseSRWLockExclusive(mutex); }
+
+static void cond_init(Cond *cond) { InitializeConditionVariable(cond); }
+static void cond_deinit(Cond *cond) { (void)cond; }
+static void cond_wait(Cond *cond, Mutex *mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+static void cond_signal(Cond *cond) { WakeConditionVariable(cond); }
+static void cond_broadcast(Cond *cond) { WakeAllConditionVariable(cond); }
+
+static maybe_unused usize cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+static void *thread_trampoline(void *param) {
+    Thread *thread = param;
+    thread->fn(thread->arg);
+    return NULL;
+}
+
+static error thread_create(Thread *thread, Thread_Fn fn, void *arg) {
+    thread->fn = fn;
+    thread->arg = arg;
+    if (pthread_create(&thread->handle, NULL, thread_trampoline, thread)) {
+        return err("failed to create thread");
+    }
+    return 0;
+}
+
+static void thread_join(Thread *thread) { pthread_join(thread->handle, NULL); }
+
+static void mutex_init(Mutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static void mutex_deinit(Mutex *mutex) { pthread_mutex_destroy(mutex); }
+static void mutex_lock(Mutex *mutex) { pthread_mutex_lock(mutex); }
+static void mutex_unlock(Mutex *mutex) { pthread_mutex_unlock(mutex); }
+
+static void cond_init(Cond *cond) { pthread_cond_init(cond, NULL); }
+static void cond_deinit(Cond *cond) { pthread_cond_destroy(cond); }
+static void cond_wait(Cond *cond, Mutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+static void cond_signal(Cond *cond) { pthread_cond_signal(cond); }
+static void cond_broadcast(Cond *cond) { pthread_cond_broadcast(cond); }
+
+static maybe_unused usize cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (usize)count : 1;
+}
+
+#endif // _WIN32
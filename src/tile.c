@@ -0,0 +1,168 @@
+// Out-of-core mode (--tiled): quantises a binary PPM image in horizontal
+// strips, so that images larger than memory can be processed. Only the strip
+// being quantised is held, along with the rows below it that diffusion
+// reaches. Those rows keep the error they received and become the top of the
+// next strip, so the result is the same as quantising the whole image at once.
+
+#define tile_rows_default 256
+
+// The next number of a PPM header, skipping whitespace and comments. The
+// single whitespace character that ends it is consumed too.
+static bool tile_read_number(FILE *in, u64 *out) {
+    int c = getc(in);
+    for (;;) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) c = getc(in);
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            c = getc(in);
+        } else {
+            break;
+        }
+    }
+    if (c < '0' || c > '9') return false;
+    u64 value = 0;
+    while (c >= '0' && c <= '9') {
+        // Far beyond any image, but short of overflowing.
+        if (value > 1000000000000ull) return false;
+        value = value * 10 + (u64)(c - '0');
+        c = getc(in);
+    }
+    *out = value;
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static error tile_read_header(FILE *in, Str8 path, u64 *width, u64 *height) {
+    u64 max_value = 0;
+    bool valid = getc(in) == 'P' && getc(in) == '6' &&
+        tile_read_number(in, width) && tile_read_number(in, height) &&
+        tile_read_number(in, &max_value);
+    if (!valid || max_value != 255) return errf(
+        "error reading '%.*s': expected a binary PPM (P6) of 8-bit channels",
+        str8_fmt(path)
+    );
+    if (*width == 0 || *height == 0) {
+        return errf("error reading '%.*s': empty image", str8_fmt(path));
+    }
+    return 0;
+}
+
+static error tile_run(
+    const Job_Options *options,
+    usize strip_rows,
+    Stats *stats,
+    Str8 infile_path,
+    Str8 outfile_path
+) {
+    if (options->palette_spec.method != PALETTE_GIVEN) return err(
+        "--tiled needs a palette of hex colours, as generating one would "
+            "need the whole image"
+    );
+    // How many rows below the current one diffusion reaches.
+    usize reach = 0;
+    for (usize i = 0; i < options->algorithm.len; i += 1) {
+        usize y_offset = (usize)options->algorithm.ptr[i].y_offset;
+        if (y_offset > reach) reach = y_offset;
+    }
+
+    FILE *in = NULL, *out = NULL;
+    try (stream_open(infile_path, false, &in));
+    u64 width = 0, height = 0;
+    error e = tile_read_header(in, infile_path, &width, &height);
+    // Strips taller than the image are the whole image.
+    if (e == 0 && strip_rows > height) strip_rows = (usize)height;
+    if (e == 0 && strip_rows > SIZE_MAX - reach) {
+        e = errf("'%.*s' is too tall", str8_fmt(infile_path));
+    }
+    usize buffer_rows = strip_rows + reach;
+    if (e == 0 && width > SIZE_MAX / 3 / buffer_rows) {
+        e = errf("'%.*s' is too wide", str8_fmt(infile_path));
+    }
+    usize row_len = (usize)width * 3;
+    u8 *buffer = NULL;
+    if (e == 0) {
+        buffer = malloc(buffer_rows * row_len);
+        if (buffer == NULL) e = err("allocation failure");
+    }
+    if (e == 0) e = stream_open(outfile_path, true, &out);
+    if (e != 0) {
+        free(buffer);
+        if (in != stdin) fclose(in);
+        return e;
+    }
+    fprintf(
+        out, "P6\n%llu %llu\n255\n",
+        (unsigned long long)width, (unsigned long long)height
+    );
+
+    Palette palette = options->palette;
+    Search search;
+    search_init(&search, palette, search_kind_for(palette.len));
+    // Kept across strips, as for frames of --raw-rgb.
+    u8 *memo = NULL;
+    if (palette.len <= image_memo_palette_max) {
+        memo = calloc(image_memo_len, 1);
+    }
+
+    bool read_failed = false, write_failed = false;
+    // Rows of the image before the buffer, and rows in the buffer.
+    u64 y = 0;
+    usize loaded = 0;
+    while (y < height) {
+        usize want = buffer_rows;
+        if (height - y < want) want = (usize)(height - y);
+        Stats_Mark mark = stats_begin(stats, infile_path, outfile_path);
+        u8 *read_ptr = buffer + loaded * row_len;
+        usize read_len = (want - loaded) * row_len;
+        if (fread(read_ptr, 1, read_len, in) != read_len) {
+            read_failed = true;
+            break;
+        }
+        stats_add(stats, STATS_READ, mark, 0, read_len);
+        // Inverted before any error is diffused into them, as when the whole
+        // image is inverted first.
+        if (options->invert) {
+            mark = stats_begin(stats, infile_path, outfile_path);
+            image_invert(read_ptr, read_len);
+            stats_add(stats, STATS_INVERT, mark, read_len / 3, read_len);
+        }
+        loaded = want;
+
+        // Every row is final once the end of the image is in the buffer.
+        usize rows = y + loaded == height ? loaded : strip_rows;
+        usize strip_len = rows * row_len;
+        mark = stats_begin(stats, infile_path, outfile_path);
+        image_quantise_strip(
+            buffer, (usize)width, rows, loaded, &search, options->algorithm,
+            memo
+        );
+        stats_add(stats, STATS_QUANTISE, mark, strip_len / 3, strip_len);
+
+        mark = stats_begin(stats, infile_path, outfile_path);
+        if (fwrite(buffer, 1, strip_len, out) != strip_len) {
+            write_failed = true;
+            break;
+        }
+        stats_add(stats, STATS_WRITE, mark, 0, strip_len);
+        memmove(buffer, buffer + strip_len, (loaded - rows) * row_len);
+        loaded -= rows;
+        y += rows;
+    }
+    if (fflush(out) != 0) write_failed = true;
+    if (!read_failed && !write_failed && stats != NULL) {
+        atom_add(&stats->outputs, 1);
+    }
+
+    free(memo);
+    free(buffer);
+    if (in != stdin) fclose(in);
+    if (out != stdout && fclose(out) != 0) write_failed = true;
+    if (read_failed) return errf(
+        "error reading '%.*s': expected %llux%llu pixels",
+        str8_fmt(infile_path),
+        (unsigned long long)width, (unsigned long long)height
+    );
+    if (write_failed) return errf(
+        "error writing '%.*s'", str8_fmt(outfile_path)
+    );
+    return 0;
+}
@@ -0,0 +1,179 @@
+// Timeline of every stage on every thread for --trace, written at exit in the
+// Chrome Trace Event format that chrome://tracing and Perfetto load. Each
+// thread appends to its own list of chunks without locking; the lists are only
+// read once the threads that wrote them have been joined.
+
+// Events per chunk, and bytes for the paths they refer to.
+#define trace_chunk_len 1024
+#define trace_chunk_text_len (64 * 1024)
+
+typedef struct Trace_Event {
+    const char *name;
+    u64 beg_ns;
+    u64 end_ns;
+    // Offsets into the chunk's text.
+    u32 input_beg, input_len;
+    u32 output_beg, output_len;
+} Trace_Event;
+
+typedef struct Trace_Chunk {
+    struct Trace_Chunk *next;
+    usize len;
+    usize text_len;
+    Trace_Event events[trace_chunk_len];
+    u8 text[trace_chunk_text_len];
+} Trace_Chunk;
+
+typedef struct Trace_Thread {
+    struct Trace_Thread *next;
+    usize id;
+    Trace_Chunk *head;
+    Trace_Chunk *tail;
+} Trace_Thread;
+
+typedef struct Trace {
+    u64 beg_ns;
+    // Pushed onto by each thread the first time it records an event.
+    Trace_Thread *threads;
+    usize threads_len;
+    // Events lost to failed allocations.
+    usize dropped;
+} Trace;
+
+static thread_local_var Trace_Thread *trace_thread;
+
+static void trace_init(Trace *trace, u64 beg_ns) {
+    *trace = (Trace){ .beg_ns = beg_ns };
+}
+
+static Trace_Thread *trace_thread_get(Trace *trace) {
+    if (trace_thread != NULL) return trace_thread;
+    Trace_Thread *thread = calloc(1, sizeof(Trace_Thread));
+    if (thread == NULL) return NULL;
+    thread->id = atom_add(&trace->threads_len, 1) + 1;
+    thread->next = atom_load(&trace->threads);
+    while (!atom_cas(&trace->threads, &thread->next, thread));
+    trace_thread = thread;
+    return thread;
+}
+
+// Paths longer than a chunk's text are cut short.
+static u32 trace_text_copy(Trace_Chunk *chunk, Str8 s, u32 *len) {
+    usize room = trace_chunk_text_len - chunk->text_len;
+    *len = (u32)(s.len < room ? s.len : room);
+    u32 beg = (u32)chunk->text_len;
+    memcpy(chunk->text + beg, s.ptr, *len);
+    chunk->text_len += *len;
+    return beg;
+}
+
+static void trace_event(
+    Trace *trace,
+    const char *name,
+    u64 beg_ns,
+    u64 end_ns,
+    Str8 input,
+    Str8 output
+) {
+    Trace_Thread *thread = trace_thread_get(trace);
+    Trace_Chunk *chunk = thread != NULL ? thread->tail : NULL;
+    if (thread != NULL && (chunk == NULL || chunk->len == trace_chunk_len ||
+        chunk->text_len + input.len + output.len > trace_chunk_text_len
+    )) {
+        chunk = malloc(sizeof(Trace_Chunk));
+        if (chunk != NULL) {
+            chunk->next = NULL;
+            chunk->len = 0;
+            chunk->text_len = 0;
+            if (thread->tail != NULL) thread->tail->next = chunk;
+            else thread->head = chunk;
+            thread->tail = chunk;
+        }
+    }
+    if (chunk == NULL) {
+        atom_add(&trace->dropped, 1);
+        return;
+    }
+
+    Trace_Event *event = &chunk->events[chunk->len];
+    chunk->len += 1;
+    event->name = name;
+    event->beg_ns = beg_ns;
+    event->end_ns = end_ns;
+    event->input_beg = trace_text_copy(chunk, input, &event->input_len);
+    event->output_beg = trace_text_copy(chunk, output, &event->output_len);
+}
+
+static void trace_write_str(FILE *file, const u8 *s, usize len) {
+    fputc('"', file);
+    for (usize i = 0; i < len; i += 1) {
+        if (s[i] == '"' || s[i] == '\\') fprintf(file, "\\%c", s[i]);
+        else if (s[i] < 0x20) fprintf(file, "\\u%04x", s[i]);
+        else fputc(s[i], file);
+    }
+    fputc('"', file);
+}
+
+// Timestamps are in microseconds from the start of the trace.
+static error trace_write(Trace *trace, Str8 path) {
+    FILE *file = NULL; try (file_open(path, "wb", &file));
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (Trace_Thread *t = trace->threads; t != NULL; t = t->next) {
+        fprintf(
+            file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+                "\"args\":{\"name\":\"thread %zu\"}}",
+            first ? "" : ",\n", t->id, t->id
+        );
+        first = false;
+        for (Trace_Chunk *c = t->head; c != NULL; c = c->next) {
+            for (usize i = 0; i < c->len; i += 1) {
+                Trace_Event *event = &c->events[i];
+                fprintf(
+                    file,
+                    ",\n{\"name\":\"%s\",\"cat\":\"imgclr\",\"ph\":\"X\","
+                        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu,"
+                        "\"args\":{",
+                    event->name,
+                    (f64)(event->beg_ns - trace->beg_ns) / 1e3,
+                    (f64)(event->end_ns - event->beg_ns) / 1e3,
+                    t->id
+                );
+                fprintf(file, "\"input\":");
+                trace_write_str(
+                    file, c->text + event->input_beg, event->input_len
+                );
+                if (event->output_len != 0) {
+                    fprintf(file, ",\"output\":");
+                    trace_write_str(
+                        file, c->text + event->output_beg, event->output_len
+                    );
+                }
+                fprintf(file, "}}");
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        return errf("error writing '%.*s'", str8_fmt(path));
+    }
+    if (trace->dropped != 0) {
+        fprintf(stderr, "trace: %zu events dropped\n", trace->dropped);
+    }
+    return 0;
+}
+
+static void trace_deinit(Trace *trace) {
+    for (Trace_Thread *t = trace->threads; t != NULL;) {
+        for (Trace_Chunk *c = t->head; c != NULL;) {
+            Trace_Chunk *next = c->next;
+            free(c);
+            c = next;
+        }
+        Trace_Thread *next = t->next;
+        free(t);
+        t = next;
+    }
+    *trace = (Trace){ 0 };
+}
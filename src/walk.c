@@ -0,0 +1,414 @@
+// Recursive directory processing: enumerates an input tree with openat and
+// readdir, mirrors its directories under the output root, and submits one job
+// per decodable image while the walk is still in progress.
+
+typedef struct Walk {
+    Batch *batch;
+    const Job_Options *options;
+    Str8 ext;
+    Format outfile_format;
+    usize found;
+    // Identifies the output root, which is not walked if it is inside the
+    // input tree.
+    u64 out_root_dev;
+    u64 out_root_ino;
+} Walk;
+
+static bool is_input_image_name(Str8 name) {
+    usize dot = name.len;
+    for (usize i = name.len; i > 0; i -= 1) {
+        if (name.ptr[i - 1] != '.') continue;
+        dot = i;
+        break;
+    }
+    if (dot == name.len) return false;
+
+    Str8 ext = str8_range(name, dot, name.len);
+    Str8 supported[] = {
+        str8("jpg"), str8("JPG"), str8("jpeg"), str8("JPEG"),
+        str8("png"), str8("PNG"),
+        str8("bmp"), str8("BMP"), str8("dib"), str8("DIB"),
+        str8("gif"), str8("GIF"),
+        str8("ppm"), str8("PPM"), str8("pgm"), str8("PGM"),
+        str8("pnm"), str8("PNM"),
+    };
+    for (usize i = 0; i < count_of(supported); i += 1) {
+        if (str8_eql(ext, supported[i])) return true;
+    }
+    return false;
+}
+
+#ifndef _WIN32
+
+// The image files and subdirectories of a directory.
+typedef struct Walk_Entry {
+    char *name;
+    bool is_dir;
+    // For image files: the name of the output, and whether writing it would
+    // replace an input, or the output of another input.
+    char *outfile_name;
+    bool replaces_input;
+    bool shares_output;
+} Walk_Entry;
+
+typedef Slice(Walk_Entry) Walk_Entries;
+
+static int walk_entry_cmp(const void *a, const void *b) {
+    const Walk_Entry *entry_a = a, *entry_b = b;
+    return strcmp(entry_a->name, entry_b->name);
+}
+
+static int walk_entry_outfile_cmp(const void *a, const void *b) {
+    const Walk_Entry *entry_a = *(Walk_Entry *const *)a;
+    const Walk_Entry *entry_b = *(Walk_Entry *const *)b;
+    return strcmp(entry_a->outfile_name, entry_b->outfile_name);
+}
+
+static void walk_entries_deinit(Walk_Entries *entries) {
+    for (usize i = 0; i < entries->len; i += 1) free(entries->ptr[i].name);
+    free(entries->ptr);
+    *entries = (Walk_Entries){ 0 };
+}
+
+static error walk_entries_push(
+    Walk *walk,
+    Walk_Entries *entries,
+    usize *cap,
+    Str8 name,
+    bool is_dir
+) {
+    if (entries->len == *cap) {
+        usize new_cap = *cap == 0 ? 64 : *cap * 2;
+        Walk_Entry *new_ptr = realloc(
+            entries->ptr, new_cap * sizeof(Walk_Entry)
+        );
+        if (new_ptr == NULL) return err("allocation failure");
+        entries->ptr = new_ptr;
+        *cap = new_cap;
+    }
+    usize stem_len = 0, outfile_name_len = 0;
+    if (!is_dir) {
+        // Image names always have an extension, which the output's replaces.
+        stem_len = name.len - 1;
+        while (name.ptr[stem_len] != '.') stem_len -= 1;
+        outfile_name_len = stem_len + 1 + walk->ext.len;
+    }
+    char *strings = malloc(name.len + 1 + outfile_name_len + 1);
+    if (strings == NULL) return err("allocation failure");
+
+    Walk_Entry *entry = &entries->ptr[entries->len];
+    entries->len += 1;
+    *entry = (Walk_Entry){ .name = strings, .is_dir = is_dir };
+    memcpy(strings, name.ptr, name.len);
+    strings[name.len] = '\0';
+    if (is_dir) return 0;
+    entry->outfile_name = strings + name.len + 1;
+    memcpy(entry->outfile_name, name.ptr, stem_len);
+    entry->outfile_name[stem_len] = '.';
+    memcpy(entry->outfile_name + stem_len + 1, walk->ext.ptr, walk->ext.len);
+    entry->outfile_name[outfile_name_len] = '\0';
+    return 0;
+}
+
+// Marks the image files whose outputs share a name, such as 'a.jpg' and
+// 'a.png', and, when the output directory is the input directory itself,
+// those whose outputs would replace an input. Jobs for these would write
+// one file at once, or one that is still being read.
+static void walk_entries_find_clashes(
+    Walk_Entries entries,
+    bool same_dir,
+    Walk_Entry **scratch
+) {
+    usize files_len = 0;
+    for (usize i = 0; i < entries.len; i += 1) {
+        if (entries.ptr[i].is_dir) continue;
+        scratch[files_len] = &entries.ptr[i];
+        files_len += 1;
+    }
+    qsort(scratch, files_len, sizeof(Walk_Entry *), walk_entry_outfile_cmp);
+    for (usize i = 1; i < files_len; i += 1) {
+        Walk_Entry *prev = scratch[i - 1], *entry = scratch[i];
+        if (strcmp(prev->outfile_name, entry->outfile_name) != 0) continue;
+        prev->shares_output = true;
+        entry->shares_output = true;
+    }
+    if (!same_dir) return;
+    for (usize i = 0; i < entries.len; i += 1) {
+        Walk_Entry *entry = &entries.ptr[i];
+        if (entry->is_dir) continue;
+        Walk_Entry key = { .name = entry->outfile_name };
+        if (bsearch(
+            &key, entries.ptr, entries.len, sizeof(Walk_Entry), walk_entry_cmp
+        ) != NULL) {
+            entry->replaces_input = true;
+        }
+    }
+}
+
+// Lists the image files and subdirectories of `dir`, sorted by name. They
+// are all read before any output is written, as new files in a directory
+// being read may or may not be listed.
+static error walk_list_dir(
+    Walk *walk,
+    Dir_Ref *dir,
+    Str8 in_path,
+    Walk_Entries *out
+) {
+    int enum_fd = dup(dir->in_fd);
+    if (enum_fd < 0) return errf(
+        "failed to read directory '%.*s'", str8_fmt(in_path)
+    );
+    DIR *listing = fdopendir(enum_fd);
+    if (listing == NULL) {
+        close(enum_fd);
+        return errf("failed to read directory '%.*s'", str8_fmt(in_path));
+    }
+
+    Walk_Entries entries = { 0 };
+    usize cap = 0;
+    error e = 0;
+    for (struct dirent *entry; (entry = readdir(listing)) != NULL;) {
+        Str8 name = str8_from_cstr(entry->d_name);
+        if (str8_eql(name, str8(".")) || str8_eql(name, str8(".."))) continue;
+
+        bool is_dir = entry->d_type == DT_DIR;
+        bool is_file = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            if (fstatat(dir->in_fd, entry->d_name, &st, 0) != 0) continue;
+            // Symlinked directories are not followed, to avoid cycles.
+            is_dir = S_ISDIR(st.st_mode) && entry->d_type != DT_LNK;
+            is_file = S_ISREG(st.st_mode);
+        }
+        if (is_file && !is_input_image_name(name)) continue;
+        if (!is_file && !is_dir) continue;
+        e = walk_entries_push(walk, &entries, &cap, name, is_dir);
+        if (e != 0) break;
+    }
+    closedir(listing);
+
+    Walk_Entry **scratch = NULL;
+    if (e == 0 && entries.len != 0) {
+        scratch = malloc(entries.len * sizeof(Walk_Entry *));
+        if (scratch == NULL) e = err("allocation failure");
+    }
+    struct stat in_st, out_st;
+    if (e == 0 && (fstat(dir->in_fd, &in_st) != 0 ||
+        fstat(dir->out_fd, &out_st) != 0
+    )) {
+        e = errf("failed to read directory '%.*s'", str8_fmt(in_path));
+    }
+    if (e != 0) {
+        free(scratch);
+        walk_entries_deinit(&entries);
+        return e;
+    }
+    qsort(entries.ptr, entries.len, sizeof(Walk_Entry), walk_entry_cmp);
+    bool same_dir =
+        in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino;
+    walk_entries_find_clashes(entries, same_dir, scratch);
+    free(scratch);
+    *out = entries;
+    return 0;
+}
+
+// `in_path` and `out_path` are only used for messages.
+static error walk_submit_file(
+    Walk *walk,
+    Dir_Ref *dir,
+    Str8 name,
+    Str8 outfile_name,
+    Str8 in_path,
+    Str8 out_path
+) {
+    usize outfile_name_len = outfile_name.len;
+    usize infile_path_len = in_path.len + 1 + name.len;
+    usize outfile_path_len = out_path.len + 1 + outfile_name_len;
+
+    Job *job = malloc(
+        sizeof(Job) + name.len + outfile_name_len +
+        infile_path_len + outfile_path_len + 4
+    );
+    if (job == NULL) return err("allocation failure");
+    u8 *strings = (u8 *)(job + 1);
+
+    *job = (Job){
+        .options = walk->options,
+        .outfile_format = walk->outfile_format,
+        .dir = dir,
+        .owned = true,
+    };
+
+    job->infile_name = (Str8){ .ptr = strings, .len = name.len };
+    memcpy(strings, name.ptr, name.len);
+    strings[name.len] = '\0';
+    strings += name.len + 1;
+
+    job->outfile_name = (Str8){ .ptr = strings, .len = outfile_name_len };
+    memcpy(strings, outfile_name.ptr, outfile_name_len);
+    strings[outfile_name_len] = '\0';
+    strings += outfile_name_len + 1;
+
+    job->infile_path = (Str8){ .ptr = strings, .len = infile_path_len };
+    memcpy(strings, in_path.ptr, in_path.len);
+    strings[in_path.len] = '/';
+    memcpy(strings + in_path.len + 1, name.ptr, name.len);
+    strings[infile_path_len] = '\0';
+    strings += infile_path_len + 1;
+
+    job->outfile_path = (Str8){ .ptr = strings, .len = outfile_path_len };
+    memcpy(strings, out_path.ptr, out_path.len);
+    strings[out_path.len] = '/';
+    memcpy(
+        strings + out_path.len + 1,
+        job->outfile_name.ptr,
+        outfile_name_len
+    );
+    strings[outfile_path_len] = '\0';
+
+    atom_add(&dir->refs, 1);
+    walk->found += 1;
+    batch_submit(walk->batch, job);
+    return 0;
+}
+
+static error walk_dir(Walk *walk, Dir_Ref *dir, Str8 in_path, Str8 out_path) {
+    Walk_Entries entries = { 0 };
+    try (walk_list_dir(walk, dir, in_path, &entries));
+
+    error e = 0;
+    for (usize i = 0; i < entries.len; i += 1) {
+        Walk_Entry *entry = &entries.ptr[i];
+        Str8 name = str8_from_cstr(entry->name);
+        Str8 outfile_name = entry->is_dir ?
+            (Str8){ 0 } : str8_from_cstr(entry->outfile_name);
+
+        if (entry->replaces_input || entry->shares_output) {
+            // Fails the batch without stopping the walk, as a failed job
+            // would.
+            errf(
+                "skipped '%.*s/%.*s': its output '%.*s/%.*s' would %s",
+                str8_fmt(in_path), str8_fmt(name),
+                str8_fmt(out_path), str8_fmt(outfile_name),
+                entry->replaces_input ? "replace an input" :
+                    "also be written for another input"
+            );
+            walk->found += 1;
+            atom_add(&walk->batch->submitted, 1);
+            atom_add(&walk->batch->failed, 1);
+            continue;
+        }
+        if (!entry->is_dir) {
+            e = walk_submit_file(
+                walk, dir, name, outfile_name, in_path, out_path
+            );
+            if (e != 0) break;
+            continue;
+        }
+
+        usize sub_in_len = in_path.len + 1 + name.len;
+        usize sub_out_len = out_path.len + 1 + name.len;
+        char *sub_paths = malloc(sub_in_len + sub_out_len + 2);
+        if (sub_paths == NULL) {
+            e = err("allocation failure");
+            break;
+        }
+        Str8 sub_in = { .ptr = (u8 *)sub_paths, .len = sub_in_len };
+        Str8 sub_out = {
+            .ptr = sub_in.ptr + sub_in_len + 1,
+            .len = sub_out_len,
+        };
+        sprintf(
+            (char *)sub_in.ptr, "%.*s/%s", str8_fmt(in_path), entry->name
+        );
+        sprintf(
+            (char *)sub_out.ptr, "%.*s/%s", str8_fmt(out_path), entry->name
+        );
+
+        int sub_in_fd = openat(
+            dir->in_fd, entry->name, O_RDONLY | O_DIRECTORY
+        );
+        struct stat sub_st;
+        if (sub_in_fd >= 0 && fstat(sub_in_fd, &sub_st) == 0 &&
+            (u64)sub_st.st_dev == walk->out_root_dev &&
+            (u64)sub_st.st_ino == walk->out_root_ino
+        ) {
+            // Its outputs would be mirrored inside it, and so on forever.
+            close(sub_in_fd);
+            free(sub_paths);
+            continue;
+        }
+        if (mkdirat(dir->out_fd, entry->name, 0777) != 0 && errno != EEXIST) {
+            if (sub_in_fd >= 0) close(sub_in_fd);
+            sub_in_fd = -1;
+        }
+        int sub_out_fd = sub_in_fd < 0 ? -1 : openat(
+            dir->out_fd, entry->name, O_RDONLY | O_DIRECTORY
+        );
+        Dir_Ref *sub = NULL;
+        if (sub_in_fd < 0 || sub_out_fd < 0 ||
+            dir_ref_new(sub_in_fd, sub_out_fd, &sub) != 0
+        ) {
+            if (sub_in_fd >= 0) close(sub_in_fd);
+            if (sub_out_fd >= 0) close(sub_out_fd);
+            e = errf(
+                "failed to mirror directory '%.*s' to '%.*s'",
+                str8_fmt(sub_in), str8_fmt(sub_out)
+            );
+        } else {
+            e = walk_dir(walk, sub, sub_in, sub_out);
+            dir_ref_release(sub);
+        }
+        free(sub_paths);
+        if (e != 0) break;
+    }
+
+    walk_entries_deinit(&entries);
+    return e;
+}
+
+static error walk_tree(Walk *walk, Str8 in_root, Str8 out_root) {
+    int in_fd = open((char *)in_root.ptr, O_RDONLY | O_DIRECTORY);
+    if (in_fd < 0) return errf(
+        "failed to open directory '%.*s'", str8_fmt(in_root)
+    );
+    if (mkdir((char *)out_root.ptr, 0777) != 0 && errno != EEXIST) {
+        close(in_fd);
+        return errf("failed to create directory '%.*s'", str8_fmt(out_root));
+    }
+    int out_fd = open((char *)out_root.ptr, O_RDONLY | O_DIRECTORY);
+    struct stat out_st;
+    if (out_fd < 0 || fstat(out_fd, &out_st) != 0) {
+        close(in_fd);
+        if (out_fd >= 0) close(out_fd);
+        return errf("failed to open directory '%.*s'", str8_fmt(out_root));
+    }
+    walk->out_root_dev = (u64)out_st.st_dev;
+    walk->out_root_ino = (u64)out_st.st_ino;
+
+    while (in_root.len > 1 && in_root.ptr[in_root.len - 1] == '/') {
+        in_root.len -= 1;
+    }
+    while (out_root.len > 1 && out_root.ptr[out_root.len - 1] == '/') {
+        out_root.len -= 1;
+    }
+
+    Dir_Ref *root = NULL;
+    if (dir_ref_new(in_fd, out_fd, &root) != 0) {
+        close(in_fd);
+        close(out_fd);
+        return 1;
+    }
+    error e = walk_dir(walk, root, in_root, out_root);
+    dir_ref_release(root);
+    return e;
+}
+
+#else
+
+static error walk_tree(Walk *walk, Str8 in_root, Str8 out_root) {
+    (void)walk; (void)in_root; (void)out_root;
+    return err("directory processing is not supported on this platform");
+}
+
+#endif // _WIN32